@@ -7,6 +7,7 @@
 #include "data_loading.h"
 #include "bwenums.h"
 #include "korean.h"
+#include "profiler.h"
 
 #include <algorithm>
 #include <utility>
@@ -283,6 +284,287 @@ struct psionic_matrix_link_f {
 	}
 };
 
+// cross_from and cross_to are the unit's unit_finder_bounding_box on the
+// other axis, so that searches can reject entries by overlap without touching
+// the unit itself. They fit in what would otherwise be padding; map
+// coordinates are well within 16 bits.
+struct unit_finder_entry {
+	unit_t* u;
+	int value;
+	int16_t cross_from;
+	int16_t cross_to;
+};
+
+// One axis of the unit finder: every entry sorted by value, stored in
+// fixed-width buckets keyed by value. Walking the buckets in order yields
+// exactly the sequence a single sorted vector would hold, including the
+// relative order of equal values, so searches visit units in the same order.
+// Insertions and removals only shift the entries of one bucket.
+struct unit_finder_axis {
+	using entry = unit_finder_entry;
+
+	a_vector<a_vector<entry>> buckets = a_vector<a_vector<entry>>(1);
+	int bucket_size = std::numeric_limits<int>::max();
+
+	struct iterator {
+		using iterator_category = std::bidirectional_iterator_tag;
+		using value_type = entry;
+		using difference_type = std::ptrdiff_t;
+		using pointer = entry*;
+		using reference = entry&;
+
+		unit_finder_axis* axis = nullptr;
+		size_t bucket = 0;
+		size_t index = 0;
+
+		iterator() = default;
+		iterator(unit_finder_axis* axis, size_t bucket, size_t index) : axis(axis), bucket(bucket), index(index) {}
+
+		entry& operator*() const {
+			return axis->buckets[bucket][index];
+		}
+		entry* operator->() const {
+			return &axis->buckets[bucket][index];
+		}
+		iterator& operator++() {
+			if (++index == axis->buckets[bucket].size()) {
+				index = 0;
+				bucket = axis->next_bucket(bucket);
+			}
+			return *this;
+		}
+		iterator operator++(int) {
+			auto r = *this;
+			++*this;
+			return r;
+		}
+		iterator& operator--() {
+			if (index == 0) {
+				do --bucket;
+				while (axis->buckets[bucket].empty());
+				index = axis->buckets[bucket].size();
+			}
+			--index;
+			return *this;
+		}
+		iterator operator--(int) {
+			auto r = *this;
+			--*this;
+			return r;
+		}
+		bool operator==(const iterator& n) const {
+			return bucket == n.bucket && index == n.index;
+		}
+		bool operator!=(const iterator& n) const {
+			return !(*this == n);
+		}
+	};
+
+	void reset(size_t extent, int new_bucket_size) {
+		if (new_bucket_size <= 0) new_bucket_size = 1;
+		bucket_size = new_bucket_size;
+		buckets.clear();
+		buckets.resize(extent / (size_t)bucket_size + 1);
+	}
+
+	// Redistributes the existing entries into buckets of a different size
+	// without changing their order.
+	void rebucket(size_t extent, int new_bucket_size) {
+		a_vector<entry> all;
+		for (auto& v : buckets) all.insert(all.end(), v.begin(), v.end());
+		reset(extent, new_bucket_size);
+		for (auto& v : all) buckets[bucket_index(v.value)].push_back(v);
+	}
+
+	size_t bucket_index(int value) const {
+		if (value < 0) return 0;
+		size_t r = (size_t)(value / bucket_size);
+		if (r >= buckets.size()) r = buckets.size() - 1;
+		return r;
+	}
+
+	size_t next_bucket(size_t bucket) const {
+		do ++bucket;
+		while (bucket != buckets.size() && buckets[bucket].empty());
+		return bucket;
+	}
+
+	iterator begin() {
+		if (buckets[0].empty()) return iterator(this, next_bucket(0), 0);
+		return iterator(this, 0, 0);
+	}
+	iterator end() {
+		return iterator(this, buckets.size(), 0);
+	}
+
+	iterator make_iterator(size_t bucket, size_t index) {
+		if (index == buckets[bucket].size()) return iterator(this, next_bucket(bucket), 0);
+		return iterator(this, bucket, index);
+	}
+
+	// First entry with entry.value >= value.
+	iterator lower_bound(int value) {
+		size_t b = bucket_index(value);
+		auto& vec = buckets[b];
+		auto i = std::lower_bound(vec.begin(), vec.end(), value, [](const entry& a, int b) {
+			return a.value < b;
+		});
+		return make_iterator(b, i - vec.begin());
+	}
+
+	// First entry with entry.value > value.
+	iterator upper_bound(int value) {
+		size_t b = bucket_index(value);
+		auto& vec = buckets[b];
+		auto i = std::upper_bound(vec.begin(), vec.end(), value, [](int a, const entry& b) {
+			return a < b.value;
+		});
+		return make_iterator(b, i - vec.begin());
+	}
+
+	// The entry of u with the given value; it must exist.
+	iterator find(const unit_t* u, int value) {
+		auto i = lower_bound(value);
+		while (i->u != u) ++i;
+		return i;
+	}
+
+	// Inserts before any entries of equal value.
+	void insert(unit_t* u, int value, int cross_from, int cross_to) {
+		auto& vec = buckets[bucket_index(value)];
+		auto i = std::lower_bound(vec.begin(), vec.end(), value, [](const entry& a, int b) {
+			return a.value < b;
+		});
+		vec.insert(i, {u, value, (int16_t)cross_from, (int16_t)cross_to});
+	}
+
+	void erase(const unit_t* u, int value) {
+		auto i = find(u, value);
+		auto& vec = buckets[i.bucket];
+		vec.erase(vec.begin() + i.index);
+	}
+
+	// Moves the entry of u from old_value to new_value. An entry that moves up
+	// ends up before any entries equal to new_value, one that moves down ends up
+	// after them. The cross extent is only looked at if the value changes or
+	// cross_changed is set.
+	void reinsert(unit_t* u, int old_value, int new_value, int cross_from, int cross_to, bool cross_changed) {
+		if (old_value == new_value) {
+			if (cross_changed) {
+				// Both entries of a unit can have the same value.
+				for (auto i = find(u, old_value); i != end() && i->value == old_value; ++i) {
+					if (i->u != u) continue;
+					i->cross_from = (int16_t)cross_from;
+					i->cross_to = (int16_t)cross_to;
+				}
+			}
+			return;
+		}
+		entry e = {u, new_value, (int16_t)cross_from, (int16_t)cross_to};
+		auto i = find(u, old_value);
+		size_t new_b = bucket_index(new_value);
+		if (new_b == i.bucket) {
+			auto& vec = buckets[new_b];
+			size_t index = i.index;
+			if (new_value > old_value) {
+				while (index + 1 != vec.size() && vec[index + 1].value < new_value) {
+					vec[index] = vec[index + 1];
+					++index;
+				}
+			} else {
+				while (index != 0 && vec[index - 1].value > new_value) {
+					vec[index] = vec[index - 1];
+					--index;
+				}
+			}
+			vec[index] = e;
+		} else {
+			auto& old_vec = buckets[i.bucket];
+			old_vec.erase(old_vec.begin() + i.index);
+			auto& vec = buckets[new_b];
+			if (new_value > old_value) {
+				auto ni = std::lower_bound(vec.begin(), vec.end(), new_value, [](const entry& a, int b) {
+					return a.value < b;
+				});
+				vec.insert(ni, e);
+			} else {
+				auto ni = std::upper_bound(vec.begin(), vec.end(), new_value, [](int a, const entry& b) {
+					return a < b.value;
+				});
+				vec.insert(ni, e);
+			}
+		}
+	}
+};
+
+// Results of pathfinder_find_long_path by exact source and destination
+// position. The long path only depends on those and on the region graph, which
+// does not change during a game, so entries never go stale. This mostly hits
+// for units leaving the same building for the same rally point, or units
+// ordered from the same spot to the same target. The cache is emptied when a
+// map is loaded and whenever it grows past max_size.
+struct long_path_cache_t {
+	struct entry {
+		a_vector<const regions_t::region*> long_path;
+		size_t full_long_path_size = 0;
+		size_t highest_open_size = 0;
+		size_t all_nodes_size = 0;
+	};
+	struct key_hash {
+		size_t operator()(const std::pair<xy, xy>& v) const {
+			uint64_t a = (uint64_t)(uint16_t)v.first.x << 16 | (uint16_t)v.first.y;
+			uint64_t b = (uint64_t)(uint16_t)v.second.x << 16 | (uint16_t)v.second.y;
+			return std::hash<uint64_t>()(a << 32 | b);
+		}
+	};
+	static const size_t max_size = 1024;
+
+	a_unordered_map<std::pair<xy, xy>, entry, key_hash> entries;
+
+	const entry* find(xy source, xy destination) const {
+		auto i = entries.find({source, destination});
+		if (i == entries.end()) return nullptr;
+		return &i->second;
+	}
+	entry& insert(xy source, xy destination) {
+		if (entries.size() >= max_size) entries.clear();
+		return entries[{source, destination}];
+	}
+	void clear() {
+		entries.clear();
+	}
+};
+
+// The tiles revealed by reveal_sight_at only depend on the sight range and
+// on the terrain heights around the origin tile, which do not change during a
+// game. The result of the propagation is kept here as a list of tile index
+// offsets per origin tile, range and height class, so a unit that has not
+// moved to a different tile since the last vision update does not walk the
+// sight mask again.
+struct sight_mask_cache_t {
+	struct entry {
+		size_t offset;
+		size_t size;
+	};
+	static const size_t max_tiles = 1024 * 1024;
+
+	a_unordered_map<uint32_t, entry> entries;
+	a_vector<int> tiles;
+
+	static uint32_t key(size_t tile_index, int range, int height_class) {
+		return (uint32_t)tile_index << 6 | (uint32_t)range << 2 | (uint32_t)height_class;
+	}
+	const entry* find(uint32_t key) const {
+		auto i = entries.find(key);
+		if (i == entries.end()) return nullptr;
+		return &i->second;
+	}
+	void clear() {
+		entries.clear();
+		tiles.clear();
+	}
+};
+
 struct state_base_non_copyable {
 
 	state_base_non_copyable() = default;
@@ -319,12 +601,11 @@ struct state_base_non_copyable {
 	intrusive_list<thingy_t, default_link_f> free_thingies;
 	a_list<thingy_t> thingies;
 
-	struct unit_finder_entry {
-		unit_t* u;
-		int value;
-	};
-	a_vector<unit_finder_entry> unit_finder_x;
-	a_vector<unit_finder_entry> unit_finder_y;
+	unit_finder_axis unit_finder_x;
+	unit_finder_axis unit_finder_y;
+
+	long_path_cache_t long_path_cache;
+	sight_mask_cache_t sight_mask_cache;
 
 	const unit_t* consider_collision_with_unit_bug;
 	const unit_t* prev_bullet_source_unit;
@@ -347,6 +628,14 @@ struct state_functions {
 	virtual void on_player_eliminated(int owner) {}
 	virtual void on_victory_state(int owner, int state) {}
 
+	// Tile changes, for frontends that keep per-tile textures up to date.
+	// on_tiles_revealed gets the tiles whose visible/explored bits were cleared
+	// as indices relative to base_index, on_tiles_visibility_reset is called when
+	// the visible bits of every tile are set again (every 100 frames).
+	virtual void on_tiles_revealed(size_t base_index, const int* relative_index, size_t count) {}
+	virtual void on_tiles_visibility_reset() {}
+	virtual void on_tile_creep_changed(size_t index) {}
+
 	virtual ~state_functions() {}
 
 	state& st;
@@ -9018,25 +9307,19 @@ struct state_functions {
 
 	unit_t* check_unit_movement_unit_collision(unit_t* u, const execute_movement_struct& ems) {
 		if (us_hidden(u)) return nullptr;
+		OPENBW_PROFILE_ZONE(zone_unit_collision);
 		xy movement = ems.position - u->sprite->position;
 
-		auto cmp_u = [&](int a, auto& b) {
-			return a < b.value;
-		};
-		auto cmp_l = [&](auto& a, int b) {
-			return a.value < b;
-		};
-
 		auto new_bb = u->unit_finder_bounding_box;
 		new_bb.from += movement;
 		new_bb.to += movement;
 
 		if (movement.x < 0) {
 			auto& arr = st.unit_finder_x;
-			for (auto i = std::upper_bound(arr.begin(), arr.end(), u->unit_finder_bounding_box.from.x, cmp_u); i != arr.begin();) {
+			for (auto i = arr.upper_bound(u->unit_finder_bounding_box.from.x); i != arr.begin();) {
 				--i;
 				if (i->value < new_bb.from.x) break;
-				if (i->u->unit_finder_bounding_box.from.y <= new_bb.to.y && i->u->unit_finder_bounding_box.to.y >= new_bb.from.y) {
+				if (i->cross_from <= new_bb.to.y && i->cross_to >= new_bb.from.y) {
 					if (unit_can_collide_with(u, i->u) && u_ground_unit(i->u)) {
 						return i->u;
 					}
@@ -9044,9 +9327,9 @@ struct state_functions {
 			}
 		} else if (movement.x > 0) {
 			auto& arr = st.unit_finder_x;
-			for (auto i = std::lower_bound(arr.begin(), arr.end(), u->unit_finder_bounding_box.to.x, cmp_l); i != arr.end(); ++i) {
+			for (auto i = arr.lower_bound(u->unit_finder_bounding_box.to.x); i != arr.end(); ++i) {
 				if (i->value > new_bb.to.x) break;
-				if (i->u->unit_finder_bounding_box.from.y <= new_bb.to.y && i->u->unit_finder_bounding_box.to.y >= new_bb.from.y) {
+				if (i->cross_from <= new_bb.to.y && i->cross_to >= new_bb.from.y) {
 					if (unit_can_collide_with(u, i->u) && u_ground_unit(i->u)) {
 						return i->u;
 					}
@@ -9055,10 +9338,10 @@ struct state_functions {
 		}
 		if (movement.y < 0) {
 			auto& arr = st.unit_finder_y;
-			for (auto i = std::upper_bound(arr.begin(), arr.end(), u->unit_finder_bounding_box.from.y, cmp_u); i != arr.begin();) {
+			for (auto i = arr.upper_bound(u->unit_finder_bounding_box.from.y); i != arr.begin();) {
 				--i;
 				if (i->value < new_bb.from.y) break;
-				if (i->u->unit_finder_bounding_box.from.x <= new_bb.to.x && i->u->unit_finder_bounding_box.to.x >= new_bb.from.x) {
+				if (i->cross_from <= new_bb.to.x && i->cross_to >= new_bb.from.x) {
 					if (unit_can_collide_with(u, i->u) && u_ground_unit(i->u)) {
 						return i->u;
 					}
@@ -9066,9 +9349,9 @@ struct state_functions {
 			}
 		} else if (movement.y > 0) {
 			auto& arr = st.unit_finder_y;
-			for (auto i = std::lower_bound(arr.begin(), arr.end(), u->unit_finder_bounding_box.to.y, cmp_l); i != arr.end(); ++i) {
+			for (auto i = arr.lower_bound(u->unit_finder_bounding_box.to.y); i != arr.end(); ++i) {
 				if (i->value > new_bb.to.y) break;
-				if (i->u->unit_finder_bounding_box.from.x <= new_bb.to.x && i->u->unit_finder_bounding_box.to.x >= new_bb.from.x) {
+				if (i->cross_from <= new_bb.to.x && i->cross_to >= new_bb.from.x) {
 					if (unit_can_collide_with(u, i->u) && u_ground_unit(i->u)) {
 						return i->u;
 					}
@@ -9218,26 +9501,73 @@ struct state_functions {
 		bool consider_collision_with_moving_units = false;
 	};
 
+	struct long_path_node {
+		long_path_node* prev = nullptr;
+		xy_fp8 pos;
+		const regions_t::region* region = nullptr;
+		fp8 total_cost{};
+		fp8 estimated_remaining_cost{};
+		fp8 estimated_final_cost{};
+		bool visited = false;
+	};
+
+	// Node storage for pathfinder_find_long_path, kept between calls. Nodes
+	// are allocated in fixed chunks so pointers to them stay valid as more
+	// are added.
+	struct long_path_node_pool {
+		static const size_t chunk_size = 128;
+		a_vector<std::unique_ptr<std::array<long_path_node, chunk_size>>> chunks;
+		size_t n = 0;
+
+		long_path_node& emplace_back() {
+			if (n == chunks.size() * chunk_size) chunks.push_back(std::make_unique<std::array<long_path_node, chunk_size>>());
+			auto& r = (*chunks[n / chunk_size])[n % chunk_size];
+			r = long_path_node();
+			++n;
+			return r;
+		}
+		long_path_node& back() {
+			return (*this)[n - 1];
+		}
+		long_path_node& operator[](size_t index) {
+			return (*chunks[index / chunk_size])[index % chunk_size];
+		}
+		size_t size() const {
+			return n;
+		}
+		void clear() {
+			n = 0;
+		}
+	};
+
+	mutable long_path_node_pool long_path_nodes;
+	mutable a_vector<long_path_node*> long_path_open;
+
 	bool pathfinder_find_long_path(pathfinder& pf) const {
 		if (pf.source_region == pf.destination_region) return false;
 
-		struct node_t {
-			node_t* prev = nullptr;
-			xy_fp8 pos;
-			const regions_t::region* region = nullptr;
-			fp8 total_cost{};
-			fp8 estimated_remaining_cost{};
-			fp8 estimated_final_cost{};
-			bool visited = false;
-		};
+		if (auto* e = st.long_path_cache.find(pf.source, pf.destination)) {
+			if (e->highest_open_size > pf.long_highest_open_size) pf.long_highest_open_size = e->highest_open_size;
+			pf.long_all_nodes_size = e->all_nodes_size;
+			pf.long_path.clear();
+			for (auto* v : e->long_path) pf.long_path.push_back(v);
+			pf.full_long_path_size = e->full_long_path_size;
+			pf.current_long_path_index = (size_t)0 - 1;
+			return !pf.long_path.empty();
+		}
+
+		using node_t = long_path_node;
 		struct cmp_node {
 			bool operator()(const node_t* a, const node_t* b) const {
 				return a->estimated_final_cost < b->estimated_final_cost;
 			}
 		};
-		a_vector<node_t*> open;
+		auto& open = long_path_open;
+		open.clear();
 
-		a_list<node_t> all_nodes;
+		auto& all_nodes = long_path_nodes;
+		all_nodes.clear();
+		size_t highest_open_size = 0;
 
 		node_t* goal_node = nullptr;
 
@@ -9251,8 +9581,7 @@ struct state_functions {
 
 			xy_fp8 to_pos = region_pos(to_region);
 
-			all_nodes.emplace_back();
-			node_t* start_node = &all_nodes.back();
+			node_t* start_node = &all_nodes.emplace_back();
 			start_node->pos = region_pos(from_region);
 			start_node->region = from_region;
 			start_node->estimated_remaining_cost = fp8::integer(128 * 128);
@@ -9285,8 +9614,7 @@ struct state_functions {
 					fp8 total_cost = cur->total_cost + cost;
 					node_t* n = (node_t*)r->pathfinder_node;
 					if (!n) {
-						all_nodes.emplace_back();
-						n = &all_nodes.back();
+						n = &all_nodes.emplace_back();
 						n->prev = cur;
 						n->pos = pos;
 						n->region = r;
@@ -9323,8 +9651,8 @@ struct state_functions {
 						add(n);
 					}
 				}
-				if (open.size() > pf.long_highest_open_size) {
-					pf.long_highest_open_size = open.size();
+				if (open.size() > highest_open_size) {
+					highest_open_size = open.size();
 				}
 				if (open.size() == 125) break;
 				if (all_nodes.size() == 350) break;
@@ -9338,10 +9666,10 @@ struct state_functions {
 				start_node->estimated_remaining_cost = xy_length(to_pos - start_node->region->center);
 				fp8 best_cost = start_node->estimated_remaining_cost;
 				node_t* best_node = start_node;
-				for (auto i = std::next(all_nodes.begin()); i != all_nodes.end(); ++i) {
-					if (i->estimated_remaining_cost < best_cost) {
-						best_cost = i->estimated_remaining_cost;
-						best_node = &*i;
+				for (size_t i = 1; i != all_nodes.size(); ++i) {
+					if (all_nodes[i].estimated_remaining_cost < best_cost) {
+						best_cost = all_nodes[i].estimated_remaining_cost;
+						best_node = &all_nodes[i];
 					}
 				}
 				goal_node = best_node;
@@ -9357,8 +9685,8 @@ struct state_functions {
 			find(pf.destination_region, pf.source_region);
 			path_is_reversed = true;
 			if (goal_node->region != pf.source_region) {
-				for (auto& v : all_nodes) {
-					v.region->pathfinder_node = nullptr;
+				for (size_t i = 0; i != all_nodes.size(); ++i) {
+					all_nodes[i].region->pathfinder_node = nullptr;
 				}
 				if (pf.source_region->group_index == goal_node->region->group_index) {
 					find(pf.source_region, goal_node->region);
@@ -9393,9 +9721,16 @@ struct state_functions {
 			}
 		}
 		pf.full_long_path_size = full_path_size;
-		for (auto& v : all_nodes) {
-			v.region->pathfinder_node = nullptr;
+		for (size_t i = 0; i != all_nodes.size(); ++i) {
+			all_nodes[i].region->pathfinder_node = nullptr;
 		}
+		if (highest_open_size > pf.long_highest_open_size) pf.long_highest_open_size = highest_open_size;
+
+		auto& e = st.long_path_cache.insert(pf.source, pf.destination);
+		e.long_path.assign(pf.long_path.begin(), pf.long_path.end());
+		e.full_long_path_size = pf.full_long_path_size;
+		e.highest_open_size = highest_open_size;
+		e.all_nodes_size = pf.long_all_nodes_size;
 		return !pf.long_path.empty();
 	}
 
@@ -9447,6 +9782,15 @@ struct state_functions {
 		return pathfinder_unit_can_collide_with(pf.u, target, pf.consider_collision_with_unit, pf.consider_collision_with_moving_units);
 	}
 
+	// Buffers for pathfinder_find_short_path that can grow without a fixed
+	// bound. They are kept between searches so that, once they have reached
+	// their working size, a search does not allocate.
+	struct short_path_buffers_t {
+		std::array<a_vector<regions_t::contour>, 4> local_edges;
+		a_vector<rect> visited_areas;
+	};
+	mutable short_path_buffers_t short_path_buffers;
+
 	void pathfinder_find_short_path(pathfinder& pf, xy target, const regions_t::region* target_region) const {
 		bool target_is_destination = target == pf.destination;
 		bool target_region_walkable = target_region && target_region->walkable();
@@ -9474,7 +9818,7 @@ struct state_functions {
 			xy cur_pos_max;
 			xy cur_pos_min;
 
-			std::array<a_vector<regions_t::contour>, 4> local_edges;
+			std::array<a_vector<regions_t::contour>, 4>& local_edges;
 
 			std::array<const regions_t::contour*, 4> nearest_edge;
 
@@ -9485,10 +9829,12 @@ struct state_functions {
 			};
 			static_vector<neighbor_t, 32> neighbors;
 
-			a_vector<rect> visited_areas;
+			a_vector<rect>& visited_areas;
+
+			explicit pf_search(short_path_buffers_t& buffers) : local_edges(buffers.local_edges), visited_areas(buffers.visited_areas) {}
 		};
 
-		pf_search w;
+		pf_search w(short_path_buffers);
 
 		w.u = pf.u;
 		w.target_unit = pf.target_unit;
@@ -9538,10 +9884,10 @@ struct state_functions {
 
 		struct visited {
 			int x;
-			a_vector<std::pair<int, int>> y;
+			static_vector<std::pair<int, int>, 10> y;
 		};
 
-		a_vector<visited> pf_area_visited;
+		static_vector<visited, 128 + 1> pf_area_visited;
 		pf_area_visited.push_back({0, {}});
 		pf_area_visited.push_back({(int)game_st.map_width, {}});
 
@@ -9675,10 +10021,7 @@ struct state_functions {
 		};
 
 		auto pf_add_local_units = [&]() {
-			auto cmp_l = [&](auto& a, int b) {
-				return a.value < b;
-			};
-			for (auto i = std::lower_bound(st.unit_finder_y.begin(), st.unit_finder_y.end(), w.cur_pos_min.y - w.inner[0] - 1, cmp_l); i != st.unit_finder_y.end(); ++i) {
+			for (auto i = st.unit_finder_y.lower_bound(w.cur_pos_min.y - w.inner[0] - 1); i != st.unit_finder_y.end(); ++i) {
 				auto& bb = i->u->unit_finder_bounding_box;
 				if (i->value >= w.cur_pos.y - w.inner[0]) break;
 				if (i->value == bb.to.y) {
@@ -9695,7 +10038,7 @@ struct state_functions {
 					}
 				}
 			}
-			for (auto i = std::lower_bound(st.unit_finder_x.begin(), st.unit_finder_x.end(), w.cur_pos.x - w.inner[1], cmp_l); i != st.unit_finder_x.end(); ++i) {
+			for (auto i = st.unit_finder_x.lower_bound(w.cur_pos.x - w.inner[1]); i != st.unit_finder_x.end(); ++i) {
 				auto& bb = i->u->unit_finder_bounding_box;
 				if (i->value > w.cur_pos_max.x - w.inner[1] + 1) break;
 				if (i->value == bb.from.x) {
@@ -9712,7 +10055,7 @@ struct state_functions {
 					}
 				}
 			}
-			for (auto i = std::lower_bound(st.unit_finder_y.begin(), st.unit_finder_y.end(), w.cur_pos.y - w.inner[2], cmp_l); i != st.unit_finder_y.end(); ++i) {
+			for (auto i = st.unit_finder_y.lower_bound(w.cur_pos.y - w.inner[2]); i != st.unit_finder_y.end(); ++i) {
 				auto& bb = i->u->unit_finder_bounding_box;
 				if (i->value > w.cur_pos_max.y - w.inner[2] + 1) break;
 				if (i->value == bb.from.y) {
@@ -9729,7 +10072,7 @@ struct state_functions {
 					}
 				}
 			}
-			for (auto i = std::lower_bound(st.unit_finder_x.begin(), st.unit_finder_x.end(), w.cur_pos_min.x - w.inner[3] - 1, cmp_l); i != st.unit_finder_x.end(); ++i) {
+			for (auto i = st.unit_finder_x.lower_bound(w.cur_pos_min.x - w.inner[3] - 1); i != st.unit_finder_x.end(); ++i) {
 				auto& bb = i->u->unit_finder_bounding_box;
 				if (i->value >= w.cur_pos.x - w.inner[3]) break;
 				if (i->value == bb.to.x) {
@@ -10755,6 +11098,7 @@ struct state_functions {
 	}
 
 	bool pathfinder_find(pathfinder& pf, bool short_path_only = false) {
+		OPENBW_PROFILE_ZONE(zone_pathfinder_find);
 		pf.source_region = get_region_at(pf.source);
 		pf.destination_region = get_region_at(pf.destination);
 		pf.unit_bb = unit_type_inner_bounding_box(pf.u->unit_type);
@@ -11450,11 +11794,11 @@ struct state_functions {
 		bool being_repulsed = apply_repulse_field(u, ems);
 		ems.position = restrict_unit_pos_to_bounds(ems.position, u->unit_type, map_bounds());
 		finish_unit_movement(u, ems);
-		if (u_can_move(u) && !ut_building(u) && u->unit_type->id != UnitTypes::Protoss_Interceptor) {
+		if (unit_uses_repulse_field(u)) {
 			size_t index = repulse_index(u->position);
 			if (index != u->repulse_index) {
-				decrement_repulse_field(u);
-				increment_repulse_field(u);
+				remove_from_repulse_field(u);
+				add_to_repulse_field(u);
 			}
 			if (being_repulsed) {
 				if (std::max(std::abs(u->move_target.pos.x - u->position.x), std::abs(u->move_target.pos.y - u->position.y)) < 24) {
@@ -12336,48 +12680,48 @@ struct state_functions {
 		return 0;
 	}
 
-	void reveal_sight_at(xy pos, int range, int reveal_to, bool in_air) {
-		int visibility_mask = ~reveal_to;
+	const sight_mask_cache_t::entry& sight_mask_at(size_t tile_x, size_t tile_y, int range, int height_class) {
+		auto& cache = st.sight_mask_cache;
+		uint32_t key = cache.key(tile_x + tile_y * game_st.map_tile_width, range, height_class);
+		if (auto* e = cache.find(key)) return *e;
+		if (cache.tiles.size() >= cache.max_tiles) cache.clear();
+
+		// Nodes are propagated from their prev/prev2 nodes; a node is blocked if it
+		// was not revealed or if its terrain is higher than the origin. Which
+		// player the vision is revealed to does not matter here, since the
+		// visible/explored bits of a revealed tile are cleared for exactly those
+		// players before they are tested.
 		int height_mask = 0;
-		if (!in_air) {
-			int height = get_ground_height_at(pos);
-			if (height == 2) height_mask = tile_t::flag_very_high;
-			else if (height == 1) height_mask = tile_t::flag_very_high | tile_t::flag_high;
-			else height_mask = tile_t::flag_very_high | tile_t::flag_high | tile_t::flag_middle;
-		}
+		if (height_class == 2) height_mask = tile_t::flag_very_high;
+		else if (height_class == 1) height_mask = tile_t::flag_very_high | tile_t::flag_high;
+		else if (height_class == 0) height_mask = tile_t::flag_very_high | tile_t::flag_high | tile_t::flag_middle;
 		const size_t max_width = 11 * 2 + 3;
-		std::array<uint32_t, max_width * max_width> vision_propagation;
-		uint32_t required_tile_mask = (uint32_t)height_mask << 16 | (uint32_t)(uint8_t)~visibility_mask << 8 | (uint32_t)(uint8_t)~visibility_mask;
+		std::array<bool, max_width * max_width> blocked;
 		const auto& sight_vals = game_st.sight_values.at(range);
-		size_t tile_x = (size_t)pos.x / 32;
-		size_t tile_y = (size_t)pos.y / 32;
-		tile_t* base_tile = &st.tiles[tile_x + tile_y*game_st.map_tile_width];
-		if (!in_air) {
+		int base_index = (int)(tile_x + tile_y * game_st.map_tile_width);
+		size_t offset = cache.tiles.size();
+		if (height_class != 3) {
 			size_t index = 0;
 			size_t end = sight_vals.min_mask_size;
 			for (; index != end; ++index) {
 				const auto& cur = sight_vals.maskdat[index];
-				vision_propagation[index] = 0xff;
+				blocked[index] = true;
 				if (tile_x + cur.x >= game_st.map_tile_width) continue;
 				if (tile_y + cur.y >= game_st.map_tile_height) continue;
-				auto& tile = base_tile[cur.relative_tile_index];
-				tile.visible &= visibility_mask;
-				tile.explored &= visibility_mask;
-				vision_propagation[index] = (uint32_t)tile.flags << 16 | (uint32_t)tile.explored << 8 | (uint32_t)tile.visible;
+				cache.tiles.push_back(cur.relative_tile_index);
+				blocked[index] = (st.tiles[base_index + cur.relative_tile_index].flags & height_mask) != 0;
 			}
 			end += sight_vals.ext_masked_count;
 			for (; index != end; ++index) {
 				const auto& cur = sight_vals.maskdat[index];
-				vision_propagation[index] = 0xff;
+				blocked[index] = true;
 				if (tile_x + cur.x >= game_st.map_tile_width) continue;
 				if (tile_y + cur.y >= game_st.map_tile_height) continue;
-				if (vision_propagation[cur.prev] & required_tile_mask) {
-					if (cur.prev2 == (size_t)~0 || (vision_propagation[cur.prev2] & required_tile_mask)) continue;
+				if (blocked[cur.prev]) {
+					if (cur.prev2 == (size_t)~0 || blocked[cur.prev2]) continue;
 				}
-				auto& tile = base_tile[cur.relative_tile_index];
-				tile.visible &= visibility_mask;
-				tile.explored &= visibility_mask;
-				vision_propagation[index] = (uint32_t)tile.flags << 16 | (uint32_t)tile.explored << 8 | (uint32_t)tile.visible;
+				cache.tiles.push_back(cur.relative_tile_index);
+				blocked[index] = (st.tiles[base_index + cur.relative_tile_index].flags & height_mask) != 0;
 			}
 		} else {
 			// This seems bugged; even for air units, if you only traverse ext_masked_count nodes,
@@ -12387,11 +12731,30 @@ struct state_functions {
 			for (; cur != end; ++cur) {
 				if (tile_x + cur->x >= game_st.map_tile_width) continue;
 				if (tile_y + cur->y >= game_st.map_tile_height) continue;
-				auto& tile = base_tile[cur->relative_tile_index];
-				tile.visible &= visibility_mask;
-				tile.explored &= visibility_mask;
+				cache.tiles.push_back(cur->relative_tile_index);
 			}
 		}
+		auto& e = cache.entries[key];
+		e.offset = offset;
+		e.size = cache.tiles.size() - offset;
+		return e;
+	}
+
+	void reveal_sight_at(xy pos, int range, int reveal_to, bool in_air) {
+		uint8_t visibility_mask = (uint8_t)~reveal_to;
+		if (visibility_mask == 0xff) return;
+		int height_class = in_air ? 3 : get_ground_height_at(pos);
+		size_t tile_x = (size_t)pos.x / 32;
+		size_t tile_y = (size_t)pos.y / 32;
+		auto& e = sight_mask_at(tile_x, tile_y, range, height_class);
+		tile_t* base_tile = &st.tiles[tile_x + tile_y * game_st.map_tile_width];
+		const int* relative_index = st.sight_mask_cache.tiles.data() + e.offset;
+		for (size_t i = 0; i != e.size; ++i) {
+			auto& tile = base_tile[relative_index[i]];
+			tile.visible &= visibility_mask;
+			tile.explored &= visibility_mask;
+		}
+		on_tiles_revealed(tile_x + tile_y * game_st.map_tile_width, relative_index, e.size);
 	}
 
 	void refresh_unit_vision(unit_t* u) {
@@ -12919,6 +13282,7 @@ struct state_functions {
 	}
 
 void update_units() {
+		OPENBW_PROFILE_ZONE(zone_update_units);
 		--st.order_timer_counter;
 		if (!st.order_timer_counter) {
 			st.order_timer_counter = 150;
@@ -12949,10 +13313,13 @@ void update_units() {
 			update_dead_unit(u);
 		}
 
-		for (unit_t* u : ptr(st.visible_units)) {
-			iscript_flingy = u;
-			iscript_unit = u;
-			update_unit_movement(u);
+		{
+			OPENBW_PROFILE_ZONE(zone_update_units_movement);
+			for (unit_t* u : ptr(st.visible_units)) {
+				iscript_flingy = u;
+				iscript_unit = u;
+				update_unit_movement(u);
+			}
 		}
 
 		if (update_tiles) {
@@ -12961,45 +13328,57 @@ void update_units() {
 			}
 		}
 
-		for (unit_t* u : ptr(st.visible_units)) {
-			update_unit_sprite(u);
-			if (u_cloaked(u) || u_requires_detector(u)) {
-				u->cloak_counter = 0;
-				if (u->secondary_order_timer) --u->secondary_order_timer;
-				else {
-					update_unit_detected_flags(u);
-					u->secondary_order_timer = 30;
+		{
+			OPENBW_PROFILE_ZONE(zone_update_units_sprite);
+			for (unit_t* u : ptr(st.visible_units)) {
+				update_unit_sprite(u);
+				if (u_cloaked(u) || u_requires_detector(u)) {
+					u->cloak_counter = 0;
+					if (u->secondary_order_timer) --u->secondary_order_timer;
+					else {
+						update_unit_detected_flags(u);
+						u->secondary_order_timer = 30;
+					}
 				}
 			}
 		}
 
-		for (auto i = st.visible_units.begin(); i != st.visible_units.end();) {
-			unit_t* u = &*i++;
-			iscript_flingy = u;
-			iscript_unit = u;
-			update_unit(u);
+		{
+			OPENBW_PROFILE_ZONE(zone_update_units_unit);
+			for (auto i = st.visible_units.begin(); i != st.visible_units.end();) {
+				unit_t* u = &*i++;
+				iscript_flingy = u;
+				iscript_unit = u;
+				update_unit(u);
+			}
 		}
 
-		for (auto i = st.hidden_units.begin(); i != st.hidden_units.end();) {
-			unit_t* u = &*i++;
-			if (u_cloaked(u) || u_requires_detector(u)) u->cloak_counter = 0;
-			iscript_flingy = u;
-			iscript_unit = u;
-			update_hidden_unit(u);
+		{
+			OPENBW_PROFILE_ZONE(zone_update_units_hidden);
+			for (auto i = st.hidden_units.begin(); i != st.hidden_units.end();) {
+				unit_t* u = &*i++;
+				if (u_cloaked(u) || u_requires_detector(u)) u->cloak_counter = 0;
+				iscript_flingy = u;
+				iscript_unit = u;
+				update_hidden_unit(u);
+			}
 		}
 
-		for (auto i = st.cloaked_units.begin(); i != st.cloaked_units.end();) {
-			unit_t* u = &*i++;
-			if (u->cloak_counter == 0) {
-				st.cloaked_units.remove(*u);
-				u->cloaked_unit_link = {nullptr, nullptr};
-				u_unset_status_flag(u, unit_t::status_flag_passively_cloaked);
-				decloak_unit(u);
-			} else {
-				if (!u_burrowed(u) && u->secondary_order_type->id == Orders::Cloak && u->cloak_counter == 1 && u_passively_cloaked(u)) {
+		{
+			OPENBW_PROFILE_ZONE(zone_update_units_cloaked);
+			for (auto i = st.cloaked_units.begin(); i != st.cloaked_units.end();) {
+				unit_t* u = &*i++;
+				if (u->cloak_counter == 0) {
+					st.cloaked_units.remove(*u);
+					u->cloaked_unit_link = {nullptr, nullptr};
 					u_unset_status_flag(u, unit_t::status_flag_passively_cloaked);
+					decloak_unit(u);
+				} else {
+					if (!u_burrowed(u) && u->secondary_order_type->id == Orders::Cloak && u->cloak_counter == 1 && u_passively_cloaked(u)) {
+						u_unset_status_flag(u, unit_t::status_flag_passively_cloaked);
+					}
+					if (!u_requires_detector(u)) cloak_unit(u);
 				}
-				if (!u_requires_detector(u)) cloak_unit(u);
 			}
 		}
 
@@ -13020,6 +13399,7 @@ void update_units() {
 	}
 
 	void update_bullets() {
+		OPENBW_PROFILE_ZONE(zone_update_bullets);
 
 		for (auto i = st.active_bullets.begin(); i != st.active_bullets.end();) {
 			bullet_t* b = &*i++;
@@ -13055,6 +13435,7 @@ void update_units() {
 	}
 
 	void update_thingies() {
+		OPENBW_PROFILE_ZONE(zone_update_thingies);
 		for (auto i = st.active_thingies.begin(); i != st.active_thingies.end();) {
 			thingy_t* t = &*i++;
 			update_thingy(t);
@@ -13084,6 +13465,7 @@ void update_units() {
 	}
 
 	void recede_creep() {
+		OPENBW_PROFILE_ZONE(zone_recede_creep);
 		if (st.creep_life.recede_timer) {
 			--st.creep_life.recede_timer;
 			return;
@@ -13160,6 +13542,7 @@ void update_units() {
 			for (auto& v : st.tiles) {
 				v.visible = 0xff;
 			}
+			on_tiles_visibility_reset();
 		}
 
 		update_units();
@@ -13168,6 +13551,7 @@ void update_units() {
 	}
 
 	void process_triggers() {
+		OPENBW_PROFILE_ZONE(zone_process_triggers);
 		int timer_step = 42;
 
 		for (size_t i = 0; i != 12; ++i) {
@@ -13190,6 +13574,7 @@ void update_units() {
 		st.trigger_timer = 30;
 
 		execute_trigger_struct ets;
+		trigger_condition_cache condition_cache;
 
 		bool any_triggers_executed = false;
 		for (int i : active_players()) {
@@ -13200,7 +13585,7 @@ void update_units() {
 				if (~rt.flags & 1) {
 					for (auto& c : t.conditions) {
 						if (c.type == 0) break;
-						if (!test_trigger_condition(c, i)) {
+						if (!test_trigger_condition(c, i, condition_cache)) {
 							execute_now = false;
 							break;
 						}
@@ -13210,6 +13595,7 @@ void update_units() {
 					rt.current_action_index = 0;
 					execute_trigger(ets, i, rt, t);
 					any_triggers_executed = true;
+					condition_cache.clear();
 				}
 			}
 		}
@@ -13253,6 +13639,7 @@ void update_units() {
 	}
 
 	void next_frame() {
+		OPENBW_PROFILE_FRAME(st.current_frame + 1);
 		++st.current_frame;
 		process_frame();
 		process_triggers();
@@ -14766,11 +15153,18 @@ void update_units() {
 		}
 	}
 
+	// Most images spend most frames blocked in a wait, so that case is kept
+	// out of the interpreter and is cheap enough to be inlined into the callers.
 	bool iscript_execute(image_t* image, iscript_state_t& state, bool noop = false, fp8* distance_moved = nullptr, bool allow_main_image_destruction = false) {
 		if (state.wait) {
 			--state.wait;
 			return true;
 		}
+		return iscript_execute_program(image, state, noop, distance_moved, allow_main_image_destruction);
+	}
+
+	bool iscript_execute_program(image_t* image, iscript_state_t& state, bool noop, fp8* distance_moved, bool allow_main_image_destruction) {
+		OPENBW_PROFILE_ZONE(zone_iscript_execute);
 
 		auto play_frame = [&](size_t frame_index) {
 			if (image->frame_index_base == frame_index) return;
@@ -14844,6 +15238,48 @@ void update_units() {
 			p += n;
 		};
 
+		// Every instruction ends in OPENBW_ISCRIPT_NEXT. With computed goto
+		// (GCC and clang) it dispatches the next instruction directly through a
+		// label table, so each opcode has its own indirect branch to predict;
+		// otherwise it breaks out of the switch and goes around the loop. The
+		// opcodes were range checked when the program was loaded.
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(OPENBW_NO_COMPUTED_GOTO)
+		static const void* const dispatch_table[] = {
+			&&iscript_op_opc_playfram, &&iscript_op_opc_playframtile, &&iscript_op_opc_sethorpos, &&iscript_op_opc_setvertpos,
+			&&iscript_op_opc_setpos, &&iscript_op_opc_wait, &&iscript_op_opc_waitrand, &&iscript_op_opc_goto,
+			&&iscript_op_opc_imgol, &&iscript_op_opc_imgul, &&iscript_op_opc_imgolorig, &&iscript_op_opc_switchul,
+			&&iscript_op_unhandled, &&iscript_op_opc_imgoluselo, &&iscript_op_unhandled, &&iscript_op_opc_sprol,
+			&&iscript_op_unhandled, &&iscript_op_opc_lowsprul, &&iscript_op_unhandled, &&iscript_op_opc_spruluselo,
+			&&iscript_op_opc_sprul, &&iscript_op_opc_sproluselo, &&iscript_op_opc_end, &&iscript_op_opc_setflipstate,
+			&&iscript_op_opc_playsnd, &&iscript_op_opc_playsndrand, &&iscript_op_opc_playsndbtwn, &&iscript_op_opc_domissiledmg,
+			&&iscript_op_opc_attackmelee, &&iscript_op_opc_followmaingraphic, &&iscript_op_opc_randcondjmp, &&iscript_op_opc_turnccwise,
+			&&iscript_op_opc_turncwise, &&iscript_op_opc_turn1cwise, &&iscript_op_opc_turnrand, &&iscript_op_unhandled,
+			&&iscript_op_opc_sigorder, &&iscript_op_opc_attackwith, &&iscript_op_opc_attack, &&iscript_op_opc_castspell,
+			&&iscript_op_opc_useweapon, &&iscript_op_opc_move, &&iscript_op_opc_gotorepeatattk, &&iscript_op_opc_engframe,
+			&&iscript_op_opc_engset, &&iscript_op_unhandled, &&iscript_op_opc_nobrkcodestart, &&iscript_op_opc_nobrkcodeend,
+			&&iscript_op_opc_ignorerest, &&iscript_op_opc_attkshiftproj, &&iscript_op_opc_tmprmgraphicstart, &&iscript_op_opc_tmprmgraphicend,
+			&&iscript_op_opc_setfldirect, &&iscript_op_opc_call, &&iscript_op_opc_return, &&iscript_op_opc_setflspeed,
+			&&iscript_op_opc_creategasoverlays, &&iscript_op_opc_pwrupcondjmp, &&iscript_op_opc_trgtrangecondjmp, &&iscript_op_opc_trgtarccondjmp,
+			&&iscript_op_opc_curdirectcondjmp, &&iscript_op_opc_imgulnextid, &&iscript_op_unhandled, &&iscript_op_opc_liftoffcondjmp,
+			&&iscript_op_opc_warpoverlay, &&iscript_op_opc_orderdone, &&iscript_op_opc_grdsprol, &&iscript_op_unhandled,
+			&&iscript_op_opc_dogrddamage,
+		};
+#define OPENBW_ISCRIPT_LABEL(name) iscript_op_##name:
+#define OPENBW_ISCRIPT_DISPATCH goto *dispatch_table[opc]
+#define OPENBW_ISCRIPT_NEXT { \
+	if (p == program_data) { \
+		destroy_image(image); \
+		return false; \
+	} \
+	opc = *p++ - 0x808091; \
+	OPENBW_ISCRIPT_DISPATCH; \
+}
+#else
+#define OPENBW_ISCRIPT_LABEL(name)
+#define OPENBW_ISCRIPT_DISPATCH
+#define OPENBW_ISCRIPT_NEXT break
+#endif
+
 		while (true) {
 			using namespace iscript_opcodes;
 			size_t pc = p - program_data;
@@ -14853,174 +15289,175 @@ void update_units() {
 			}
 			int opc = *p++ - 0x808091;
 			int a, b, c;
+			OPENBW_ISCRIPT_DISPATCH;
 			switch (opc) {
-			case opc_playfram:
+			case opc_playfram: OPENBW_ISCRIPT_LABEL(opc_playfram)
 				a = *p++;
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				play_frame(a);
-				break;
-			case opc_playframtile:
+				OPENBW_ISCRIPT_NEXT;
+			case opc_playframtile: OPENBW_ISCRIPT_LABEL(opc_playframtile)
 				a = *p++;
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				if ((size_t)a + game_st.tileset_index < image->grp->frames.size()) play_frame(a + game_st.tileset_index);
-				break;
-			case opc_sethorpos:
+				OPENBW_ISCRIPT_NEXT;
+			case opc_sethorpos: OPENBW_ISCRIPT_LABEL(opc_sethorpos)
 				a = *p++;
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				if (image->offset.x != a) {
 					image->offset.x = a;
 					image->flags |= image_t::flag_redraw;
 				}
-				break;
-			case opc_setvertpos:
+				OPENBW_ISCRIPT_NEXT;
+			case opc_setvertpos: OPENBW_ISCRIPT_LABEL(opc_setvertpos)
 				a = *p++;
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				if (!iscript_unit || (!u_requires_detector(iscript_unit) && !u_cloaked(iscript_unit))) {
 					if (image->offset.y != a) {
 						image->offset.y = a;
 						image->flags |= image_t::flag_redraw;
 					}
 				}
-				break;
-			case opc_setpos:
+				OPENBW_ISCRIPT_NEXT;
+			case opc_setpos: OPENBW_ISCRIPT_LABEL(opc_setpos)
 				a = *p++;
 				b = *p++;
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				set_image_offset(image, xy(a, b));
-				break;
-			case opc_wait:
+				OPENBW_ISCRIPT_NEXT;
+			case opc_wait: OPENBW_ISCRIPT_LABEL(opc_wait)
 				state.wait = *p++ - 1;
 				state.program_counter = p - program_data;
 				return true;
-			case opc_waitrand:
+			case opc_waitrand: OPENBW_ISCRIPT_LABEL(opc_waitrand)
 				a = *p++;
 				b = *p++;
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				state.wait = a + ((lcg_rand(3) & 0xff) % (b - a + 1)) - 1;
 				state.program_counter = p - program_data;
 				return true;
-			case opc_goto:
+			case opc_goto: OPENBW_ISCRIPT_LABEL(opc_goto)
 				p = program_data + *p;
-				break;
-			case opc_imgol:
-			case opc_imgul:
+				OPENBW_ISCRIPT_NEXT;
+			case opc_imgol: OPENBW_ISCRIPT_LABEL(opc_imgol)
+			case opc_imgul: OPENBW_ISCRIPT_LABEL(opc_imgul)
 				a = *p++;
 				b = *p++;
 				c = *p++;
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				add_image((ImageTypes)a, image->offset + xy(b, c), opc == opc_imgol ? image_order_above : image_order_below);
-				break;
-			case opc_imgolorig:
-			case opc_switchul:
+				OPENBW_ISCRIPT_NEXT;
+			case opc_imgolorig: OPENBW_ISCRIPT_LABEL(opc_imgolorig)
+			case opc_switchul: OPENBW_ISCRIPT_LABEL(opc_switchul)
 				a = *p++;
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				if (image_t* new_image = add_image((ImageTypes)a, xy(), opc == opc_imgolorig ? image_order_above : image_order_below)) {
 					if (!i_flag(new_image, image_t::flag_uses_special_offset)) {
 						i_set_flag(new_image, image_t::flag_uses_special_offset);
 						update_image_special_offset(new_image);
 					}
 				}
-				break;
-			case opc_imgoluselo:
+				OPENBW_ISCRIPT_NEXT;
+			case opc_imgoluselo: OPENBW_ISCRIPT_LABEL(opc_imgoluselo)
 				a = *p++;
 				b = *p++;
 				c = *p++;
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				add_image((ImageTypes)a, get_image_lo_offset(image, (size_t)b, (size_t)c), image_order_above);
-				break;
+				OPENBW_ISCRIPT_NEXT;
 
-			case opc_sprol:
+			case opc_sprol: OPENBW_ISCRIPT_LABEL(opc_sprol)
 				a = *p++;
 				b = *p++;
 				c = *p++;
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				if (iscript_bullet && iscript_bullet->bullet_owner_unit && unit_is_goliath(iscript_bullet->bullet_owner_unit) && player_has_upgrade(iscript_bullet->bullet_owner_unit->owner, UpgradeTypes::Charon_Boosters)) {
 					create_thingy_at_image(image, get_sprite_type(SpriteTypes::SPRITEID_Halo_Rockets_Trail), {b, c}, image->sprite->elevation_level + 1);
 				} else {
 					create_thingy_at_image(image, get_sprite_type((SpriteTypes)a), {b, c}, image->sprite->elevation_level + 1);
 				}
-				break;
+				OPENBW_ISCRIPT_NEXT;
 
-			case opc_lowsprul:
+			case opc_lowsprul: OPENBW_ISCRIPT_LABEL(opc_lowsprul)
 				a = *p++;
 				b = *p++;
 				c = *p++;
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				create_thingy_at_image(image, get_sprite_type((SpriteTypes)a), {b, c}, 1);
-				break;
+				OPENBW_ISCRIPT_NEXT;
 
-			case opc_spruluselo:
+			case opc_spruluselo: OPENBW_ISCRIPT_LABEL(opc_spruluselo)
 				a = *p++;
 				b = *p++;
 				c = *p++;
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				if (auto* sprite = get_sprite_type((SpriteTypes)a)) {
-					if (iscript_unit && (u_requires_detector(iscript_unit) || u_cloaked(iscript_unit)) && !sprite->image->always_visible) break;
+					if (iscript_unit && (u_requires_detector(iscript_unit) || u_cloaked(iscript_unit)) && !sprite->image->always_visible) OPENBW_ISCRIPT_NEXT;
 					auto* t = create_thingy_at_image(image, sprite, {b, c}, image->sprite->elevation_level);
 					if (t) set_sprite_images_heading_by_image_index(t->sprite, image);
 				}
-				break;
-			case opc_sprul:
+				OPENBW_ISCRIPT_NEXT;
+			case opc_sprul: OPENBW_ISCRIPT_LABEL(opc_sprul)
 				a = *p++;
 				b = *p++;
 				c = *p++;
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				if (auto* sprite = get_sprite_type((SpriteTypes)a)) {
-					if (iscript_unit && (u_requires_detector(iscript_unit) || u_cloaked(iscript_unit)) && !sprite->image->always_visible) break;
+					if (iscript_unit && (u_requires_detector(iscript_unit) || u_cloaked(iscript_unit)) && !sprite->image->always_visible) OPENBW_ISCRIPT_NEXT;
 					auto* t = create_thingy_at_image(image, sprite, {b, c}, image->sprite->elevation_level - 1);
 					if (t) set_sprite_images_heading_by_image_index(t->sprite, image);
 				}
-				break;
-			case opc_sproluselo:
+				OPENBW_ISCRIPT_NEXT;
+			case opc_sproluselo: OPENBW_ISCRIPT_LABEL(opc_sproluselo)
 				a = *p++;
 				b = *p++;
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				if (auto* sprite = get_sprite_type((SpriteTypes)a)) {
 					auto* t = create_thingy_at_image(image, sprite, get_image_lo_offset(image, (size_t)b, 0), image->sprite->elevation_level + 1);
 					if (t) set_sprite_images_heading_by_image_index(t->sprite, image);
 				}
-				break;
-			case opc_end:
-				if (noop) break;
+				OPENBW_ISCRIPT_NEXT;
+			case opc_end: OPENBW_ISCRIPT_LABEL(opc_end)
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				if (image == image->sprite->main_image && !allow_main_image_destruction) error("iscript_execute: main image not allowed to be destroyed here");
 				state.program_counter = 0;
 				destroy_image(image);
 				return false;
-			case opc_setflipstate:
+			case opc_setflipstate: OPENBW_ISCRIPT_LABEL(opc_setflipstate)
 				a = *p++;
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				if (i_flag(image, image_t::flag_horizontally_flipped) != (a != 0)) {
 					i_set_flag(image, image_t::flag_horizontally_flipped, a != 0);
 					set_image_modifier(image, image->modifier);
 					if (image->flags & image_t::flag_uses_special_offset) update_image_special_offset(image);
 				}
-				break;
-			case opc_playsnd:
+				OPENBW_ISCRIPT_NEXT;
+			case opc_playsnd: OPENBW_ISCRIPT_LABEL(opc_playsnd)
 				a = *p++;
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				play_sound(a, image->sprite->position);
-				break;
-			case opc_playsndrand:
+				OPENBW_ISCRIPT_NEXT;
+			case opc_playsndrand: OPENBW_ISCRIPT_LABEL(opc_playsndrand)
 				playsndrand();
-				break;
-			case opc_playsndbtwn:
+				OPENBW_ISCRIPT_NEXT;
+			case opc_playsndbtwn: OPENBW_ISCRIPT_LABEL(opc_playsndbtwn)
 				a = *p++;
 				b = *p++;
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				play_sound(a + lcg_rand(5) % (b - a + 1), image->sprite->position);
-				break;
-			case opc_domissiledmg:
-			case opc_dogrddamage:
-				if (noop) break;
+				OPENBW_ISCRIPT_NEXT;
+			case opc_domissiledmg: OPENBW_ISCRIPT_LABEL(opc_domissiledmg)
+			case opc_dogrddamage: OPENBW_ISCRIPT_LABEL(opc_dogrddamage)
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				if (iscript_bullet) bullet_hit(iscript_bullet);
-				break;
-			case opc_attackmelee:
+				OPENBW_ISCRIPT_NEXT;
+			case opc_attackmelee: OPENBW_ISCRIPT_LABEL(opc_attackmelee)
 				if (!noop && iscript_unit) melee_deal_damage(iscript_unit);
 				playsndrand();
-				break;
+				OPENBW_ISCRIPT_NEXT;
 
-			case opc_followmaingraphic:
-				if (noop) break;
+			case opc_followmaingraphic: OPENBW_ISCRIPT_LABEL(opc_followmaingraphic)
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				if (image_t* main_image = image->sprite->main_image) {
 					auto frame_index = main_image->frame_index;
 					bool flipped = i_flag(main_image, image_t::flag_horizontally_flipped);
@@ -15029,104 +15466,104 @@ void update_units() {
 						set_image_frame_index_offset(image, main_image->frame_index_offset, flipped);
 					}
 				}
-				break;
-			case opc_randcondjmp:
+				OPENBW_ISCRIPT_NEXT;
+			case opc_randcondjmp: OPENBW_ISCRIPT_LABEL(opc_randcondjmp)
 				a = *p++;
 				b = *p++;
 				if ((lcg_rand(7) & 0xff) <= a) {
 					p = program_data + b;
 				}
-				break;
+				OPENBW_ISCRIPT_NEXT;
 
-			case opc_turnccwise:
+			case opc_turnccwise: OPENBW_ISCRIPT_LABEL(opc_turnccwise)
 				a = *p++;
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				if (iscript_unit) set_unit_heading(iscript_unit, iscript_unit->heading - 8_dir * a);
-				break;
-			case opc_turncwise:
+				OPENBW_ISCRIPT_NEXT;
+			case opc_turncwise: OPENBW_ISCRIPT_LABEL(opc_turncwise)
 				a = *p++;
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				if (iscript_unit) set_unit_heading(iscript_unit, iscript_unit->heading + 8_dir * a);
-				break;
-			case opc_turn1cwise:
-				if (noop) break;
+				OPENBW_ISCRIPT_NEXT;
+			case opc_turn1cwise: OPENBW_ISCRIPT_LABEL(opc_turn1cwise)
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				if (iscript_unit && !iscript_unit->order_target.unit) set_unit_heading(iscript_unit, iscript_unit->heading + 8_dir);
-				break;
-			case opc_turnrand:
+				OPENBW_ISCRIPT_NEXT;
+			case opc_turnrand: OPENBW_ISCRIPT_LABEL(opc_turnrand)
 				a = *p++;
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				if (lcg_rand(6) % 4 == 1) {
 					if (iscript_unit) set_unit_heading(iscript_unit, iscript_unit->heading - 8_dir * a);
 				} else {
 					if (iscript_unit) set_unit_heading(iscript_unit, iscript_unit->heading + 8_dir * a);
 				}
-				break;
+				OPENBW_ISCRIPT_NEXT;
 
-			case opc_sigorder:
+			case opc_sigorder: OPENBW_ISCRIPT_LABEL(opc_sigorder)
 				a = *p++;
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				if (iscript_flingy) iscript_flingy->order_signal |= a;
-				break;
-			case opc_attackwith:
+				OPENBW_ISCRIPT_NEXT;
+			case opc_attackwith: OPENBW_ISCRIPT_LABEL(opc_attackwith)
 				a = *p++;
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				if (iscript_unit) attack_with(a);
-				break;
-			case opc_attack:
-				if (noop) break;
+				OPENBW_ISCRIPT_NEXT;
+			case opc_attack: OPENBW_ISCRIPT_LABEL(opc_attack)
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				if (iscript_unit && iscript_unit->order_target.unit) {
 					if (!u_flying(iscript_unit->order_target.unit)) {
 						attack_with(1);
 					} else attack_with(2);
 				}
-				break;
-			case opc_castspell:
-				if (noop) break;
+				OPENBW_ISCRIPT_NEXT;
+			case opc_castspell: OPENBW_ISCRIPT_LABEL(opc_castspell)
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				if (iscript_unit && iscript_unit->order_type->weapon != WeaponTypes::None) {
 					if (spell_order_valid(iscript_unit)) {
 						attack_with_weapon(get_weapon_type(iscript_unit->order_type->weapon));
 					}
 				}
-				break;
-			case opc_useweapon:
+				OPENBW_ISCRIPT_NEXT;
+			case opc_useweapon: OPENBW_ISCRIPT_LABEL(opc_useweapon)
 				a = *p++;
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				if (iscript_unit) use_weapon(iscript_unit, (WeaponTypes)a);
-				break;
-			case opc_move:
+				OPENBW_ISCRIPT_NEXT;
+			case opc_move: OPENBW_ISCRIPT_LABEL(opc_move)
 				a = *p++;
 				if (distance_moved) {
 					if (iscript_unit) *distance_moved = get_modified_unit_speed(iscript_unit, fp8::integer(a));
 				}
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				if (iscript_unit) set_next_speed(iscript_unit, get_modified_unit_speed(iscript_unit, fp8::integer(a)));
-				break;
-			case opc_gotorepeatattk:
-				if (noop) break;
+				OPENBW_ISCRIPT_NEXT;
+			case opc_gotorepeatattk: OPENBW_ISCRIPT_LABEL(opc_gotorepeatattk)
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				if (iscript_unit) u_unset_movement_flag(iscript_unit, 8);
-				break;
-			case opc_engframe:
+				OPENBW_ISCRIPT_NEXT;
+			case opc_engframe: OPENBW_ISCRIPT_LABEL(opc_engframe)
 				a = *p++;
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				image->frame_index_base = a;
 				set_image_frame_index_offset(image, image->sprite->main_image->frame_index_offset, i_flag(image->sprite->main_image, image_t::flag_horizontally_flipped));
-				break;
-			case opc_engset:
+				OPENBW_ISCRIPT_NEXT;
+			case opc_engset: OPENBW_ISCRIPT_LABEL(opc_engset)
 				a = *p++;
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				image->frame_index_base = image->sprite->main_image->frame_index_base + (image->sprite->main_image->grp->frames.size() & 0x7fff) * a;
 				set_image_frame_index_offset(image, image->sprite->main_image->frame_index_offset, i_flag(image->sprite->main_image, image_t::flag_horizontally_flipped));
-				break;
+				OPENBW_ISCRIPT_NEXT;
 
-			case opc_nobrkcodestart:
-				if (noop) break;
+			case opc_nobrkcodestart: OPENBW_ISCRIPT_LABEL(opc_nobrkcodestart)
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				if (iscript_unit) {
 					u_set_status_flag(iscript_unit, unit_t::status_flag_iscript_nobrk);
 					iscript_unit->sprite->flags |= sprite_t::flag_iscript_nobrk;
 				}
-				break;
-			case opc_nobrkcodeend:
-				if (noop) break;
+				OPENBW_ISCRIPT_NEXT;
+			case opc_nobrkcodeend: OPENBW_ISCRIPT_LABEL(opc_nobrkcodeend)
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				if (iscript_unit) {
 					u_unset_status_flag(iscript_unit, unit_t::status_flag_iscript_nobrk);
 					iscript_unit->sprite->flags &= ~sprite_t::flag_iscript_nobrk;
@@ -15135,136 +15572,139 @@ void update_units() {
 						activate_next_order(iscript_unit);
 					}
 				}
-				break;
-			case opc_ignorerest:
-				if (noop) break;
+				OPENBW_ISCRIPT_NEXT;
+			case opc_ignorerest: OPENBW_ISCRIPT_LABEL(opc_ignorerest)
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				if (iscript_unit && !iscript_unit->order_target.unit) {
 					iscript_run_to_idle(iscript_unit);
-					break;
+					OPENBW_ISCRIPT_NEXT;
 				}
 				state.wait = 10;
 				state.program_counter = p - 1 - program_data;
 				return true;
-			case opc_attkshiftproj:
+			case opc_attkshiftproj: OPENBW_ISCRIPT_LABEL(opc_attkshiftproj)
 				a = *p++;
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				if (iscript_unit) attack_with_forward_offset(1, a);
-				break;
-			case opc_tmprmgraphicstart:
-				if (noop) break;
+				OPENBW_ISCRIPT_NEXT;
+			case opc_tmprmgraphicstart: OPENBW_ISCRIPT_LABEL(opc_tmprmgraphicstart)
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				hide_image(image);
-				break;
-			case opc_tmprmgraphicend:
-				if (noop) break;
+				OPENBW_ISCRIPT_NEXT;
+			case opc_tmprmgraphicend: OPENBW_ISCRIPT_LABEL(opc_tmprmgraphicend)
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				show_image(image);
-				break;
+				OPENBW_ISCRIPT_NEXT;
 
-			case opc_setfldirect:
+			case opc_setfldirect: OPENBW_ISCRIPT_LABEL(opc_setfldirect)
 				a = *p++;
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				if (iscript_unit) set_unit_heading(iscript_unit, 8_dir * a);
-				break;
+				OPENBW_ISCRIPT_NEXT;
 
-			case opc_setflspeed:
+			case opc_setflspeed: OPENBW_ISCRIPT_LABEL(opc_setflspeed)
 				a = *p++;
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				if (iscript_unit) iscript_unit->flingy_top_speed = fp8::from_raw(a);
-				break;
+				OPENBW_ISCRIPT_NEXT;
 
-			case opc_call:
+			case opc_call: OPENBW_ISCRIPT_LABEL(opc_call)
 				a = *p++;
 				state.return_address = p - program_data;
 				p = program_data + a;
-				break;
-			case opc_return:
+				OPENBW_ISCRIPT_NEXT;
+			case opc_return: OPENBW_ISCRIPT_LABEL(opc_return)
 				p = program_data + state.return_address;
-				break;
+				OPENBW_ISCRIPT_NEXT;
 
-			case opc_creategasoverlays:
+			case opc_creategasoverlays: OPENBW_ISCRIPT_LABEL(opc_creategasoverlays)
 				a = *p++;
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				if (iscript_unit && ut_resource(iscript_unit)) {
 					ImageTypes image_id = iscript_unit->building.resource.resource_count ? ImageTypes::IMAGEID_Vespene_Geyser_Smoke1 : ImageTypes::IMAGEID_Vespene_Geyser_Smoke1_Overlay;
 					image_id = (ImageTypes)((size_t)image_id + a);
 					create_image(get_image_type(image_id), image->sprite, image->offset + get_image_lo_offset(image, 2, a), image_order_above);
 				}
-				break;
-			case opc_pwrupcondjmp:
+				OPENBW_ISCRIPT_NEXT;
+			case opc_pwrupcondjmp: OPENBW_ISCRIPT_LABEL(opc_pwrupcondjmp)
 				a = *p++;
 				if (image->sprite && image->sprite->main_image != image) {
 					p = program_data + a;
 				}
-				break;
-			case opc_trgtrangecondjmp:
+				OPENBW_ISCRIPT_NEXT;
+			case opc_trgtrangecondjmp: OPENBW_ISCRIPT_LABEL(opc_trgtrangecondjmp)
 				a = *p++;
 				b = *p++;
-				if (noop) continue;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				if (iscript_unit && iscript_unit->order_target.unit) {
 					xy pos = get_bullet_appear_at_target_pos(iscript_unit, iscript_unit->order_target.unit);
 					if (xy_length(to_xy_fp8(pos) - iscript_unit->exact_position).integer_part() <= a) {
 						p = program_data + b;
 					}
 				}
-				break;
-			case opc_trgtarccondjmp:
+				OPENBW_ISCRIPT_NEXT;
+			case opc_trgtarccondjmp: OPENBW_ISCRIPT_LABEL(opc_trgtarccondjmp)
 				a = *p++;
 				b = *p++;
 				c = *p++;
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				if (iscript_unit && iscript_unit->order_target.unit) {
 					if (fp8::extend(direction_t::from_raw(a) - xy_direction(iscript_unit->order_target.unit->sprite->position - iscript_unit->sprite->position)).abs() < fp8::from_raw(b)) {
 						p = program_data + c;
 					}
 				}
-				break;
-			case opc_curdirectcondjmp:
+				OPENBW_ISCRIPT_NEXT;
+			case opc_curdirectcondjmp: OPENBW_ISCRIPT_LABEL(opc_curdirectcondjmp)
 				a = *p++;
 				b = *p++;
 				c = *p++;
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				if (iscript_unit && fp8::extend(iscript_unit->heading - direction_t::from_raw(a)).abs() < fp8::from_raw(b)) {
 					p = program_data + c;
 				}
-				break;
-			case opc_imgulnextid:
+				OPENBW_ISCRIPT_NEXT;
+			case opc_imgulnextid: OPENBW_ISCRIPT_LABEL(opc_imgulnextid)
 				a = *p++;
 				b = *p++;
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				add_image((ImageTypes)((int)image->image_type->id + 1), image->offset + xy(a, b), image_order_below);
-				break;
+				OPENBW_ISCRIPT_NEXT;
 
-			case opc_liftoffcondjmp:
+			case opc_liftoffcondjmp: OPENBW_ISCRIPT_LABEL(opc_liftoffcondjmp)
 				a = *p++;
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				if (iscript_unit && u_flying(iscript_unit)) {
 					p = program_data + a;
 				}
-				break;
-			case opc_warpoverlay:
+				OPENBW_ISCRIPT_NEXT;
+			case opc_warpoverlay: OPENBW_ISCRIPT_LABEL(opc_warpoverlay)
 				a = *p++;
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				image->modifier_data1 = a & 0xff;
 				image->modifier_data2 = (a >> 8) & 0xff;
-				break;
-			case opc_orderdone:
+				OPENBW_ISCRIPT_NEXT;
+			case opc_orderdone: OPENBW_ISCRIPT_LABEL(opc_orderdone)
 				a = *p++;
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				if (iscript_flingy) iscript_flingy->order_signal &= ~a;
-				break;
-			case opc_grdsprol:
+				OPENBW_ISCRIPT_NEXT;
+			case opc_grdsprol: OPENBW_ISCRIPT_LABEL(opc_grdsprol)
 				a = *p++;
 				b = *p++;
 				c = *p++;
-				if (noop) break;
+				if (noop) OPENBW_ISCRIPT_NEXT;
 				if (unit_type_can_fit_at(get_unit_type(UnitTypes::Terran_Marine), image->sprite->position + image->offset + xy(b, c))) {
 					create_thingy_at_image(image, get_sprite_type((SpriteTypes)a), xy(b, c), image->sprite->elevation_level + 1);
 				}
-				break;
-			default:
+				OPENBW_ISCRIPT_NEXT;
+			default: OPENBW_ISCRIPT_LABEL(unhandled)
 				error("iscript: unhandled opcode %d", opc);
 			}
 		}
 
+#undef OPENBW_ISCRIPT_LABEL
+#undef OPENBW_ISCRIPT_DISPATCH
+#undef OPENBW_ISCRIPT_NEXT
 	}
 
 	bool iscript_run_anim(image_t* image, int new_anim) {
@@ -15636,80 +16076,43 @@ void update_units() {
 
 	void unit_finder_remove(unit_t* u) {
 		if (u->unit_finder_bounding_box.from.x == -1) return;
+		OPENBW_PROFILE_ZONE(zone_unit_finder_remove);
 		if (unit_finder_search_index) error("attempt to modify unit finder while search is active");
-		auto remove = [&](auto& vec, int value) {
-			auto cmp_l = [&](auto& a, int b) {
-				return a.value < b;
-			};
-			auto i = std::lower_bound(vec.begin(), vec.end(), value, cmp_l);
-			while (i->u != u) ++i;
-			vec.erase(i);
-		};
-		remove(st.unit_finder_x, u->unit_finder_bounding_box.from.x);
-		remove(st.unit_finder_x, u->unit_finder_bounding_box.to.x);
-		remove(st.unit_finder_y, u->unit_finder_bounding_box.from.y);
-		remove(st.unit_finder_y, u->unit_finder_bounding_box.to.y);
+		st.unit_finder_x.erase(u, u->unit_finder_bounding_box.from.x);
+		st.unit_finder_x.erase(u, u->unit_finder_bounding_box.to.x);
+		st.unit_finder_y.erase(u, u->unit_finder_bounding_box.from.y);
+		st.unit_finder_y.erase(u, u->unit_finder_bounding_box.to.y);
 		u->unit_finder_bounding_box = {{-1, -1}, {-1, -1}};
 	}
 
 	void unit_finder_insert(unit_t* u, rect bb) {
+		OPENBW_PROFILE_ZONE(zone_unit_finder_insert);
 		if (unit_finder_search_index) error("attempt to modify unit finder while search is active");
-		auto insert = [&](auto& vec, int from_value, int to_value) {
-			auto cmp_l = [&](auto& a, int b) {
-				return a.value < b;
-			};
-			auto from_i = std::lower_bound(vec.begin(), vec.end(), from_value, cmp_l);
-			vec.insert(from_i, {u, from_value});
-			auto to_i = std::lower_bound(vec.begin(), vec.end(), to_value, cmp_l);
-			vec.insert(to_i, {u, to_value});
-		};
-		insert(st.unit_finder_x, bb.from.x, bb.to.x);
-		insert(st.unit_finder_y, bb.from.y, bb.to.y);
+		st.unit_finder_x.insert(u, bb.from.x, bb.from.y, bb.to.y);
+		st.unit_finder_x.insert(u, bb.to.x, bb.from.y, bb.to.y);
+		st.unit_finder_y.insert(u, bb.from.y, bb.from.x, bb.to.x);
+		st.unit_finder_y.insert(u, bb.to.y, bb.from.x, bb.to.x);
 		u->unit_finder_bounding_box = bb;
 	}
 	void unit_finder_reinsert(unit_t* u, rect bb) {
+		OPENBW_PROFILE_ZONE(zone_unit_finder_reinsert);
 		if (unit_finder_search_index) error("attempt to modify unit finder while search is active");
-		auto reinsert = [&](auto& vec, int old_value, int new_value) {
-			if (old_value == new_value) return;
-			auto cmp_l = [&](auto& a, int b) {
-				return a.value < b;
-			};
-			auto i = std::lower_bound(vec.begin(), vec.end(), old_value, cmp_l);
-			while (i->u != u) ++i;
-			if (new_value > old_value) {
-				auto ni = std::next(i);
-				while (ni != vec.end() && ni->value < new_value) {
-					*i = *ni;
-					++i;
-					++ni;
-				}
-				*i = {u, new_value};
-			} else {
-				while (i != vec.begin()) {
-					auto ni = i;
-					--i;
-					if (i->value <= new_value) {
-						++i;
-						break;
-					}
-					*ni = *i;
-				}
-				*i = {u, new_value};
-			}
-		};
-		if (bb.from.x <= u->unit_finder_bounding_box.from.x) {
-			reinsert(st.unit_finder_x, u->unit_finder_bounding_box.from.x, bb.from.x);
-			reinsert(st.unit_finder_x, u->unit_finder_bounding_box.to.x, bb.to.x);
+		rect old_bb = u->unit_finder_bounding_box;
+		bool x_changed = bb.from.x != old_bb.from.x || bb.to.x != old_bb.to.x;
+		bool y_changed = bb.from.y != old_bb.from.y || bb.to.y != old_bb.to.y;
+		if (bb.from.x <= old_bb.from.x) {
+			st.unit_finder_x.reinsert(u, old_bb.from.x, bb.from.x, bb.from.y, bb.to.y, y_changed);
+			st.unit_finder_x.reinsert(u, old_bb.to.x, bb.to.x, bb.from.y, bb.to.y, y_changed);
 		} else {
-			reinsert(st.unit_finder_x, u->unit_finder_bounding_box.to.x, bb.to.x);
-			reinsert(st.unit_finder_x, u->unit_finder_bounding_box.from.x, bb.from.x);
+			st.unit_finder_x.reinsert(u, old_bb.to.x, bb.to.x, bb.from.y, bb.to.y, y_changed);
+			st.unit_finder_x.reinsert(u, old_bb.from.x, bb.from.x, bb.from.y, bb.to.y, y_changed);
 		}
-		if (bb.from.y <= u->unit_finder_bounding_box.from.y) {
-			reinsert(st.unit_finder_y, u->unit_finder_bounding_box.from.y, bb.from.y);
-			reinsert(st.unit_finder_y, u->unit_finder_bounding_box.to.y, bb.to.y);
+		if (bb.from.y <= old_bb.from.y) {
+			st.unit_finder_y.reinsert(u, old_bb.from.y, bb.from.y, bb.from.x, bb.to.x, x_changed);
+			st.unit_finder_y.reinsert(u, old_bb.to.y, bb.to.y, bb.from.x, bb.to.x, x_changed);
 		} else {
-			reinsert(st.unit_finder_y, u->unit_finder_bounding_box.to.y, bb.to.y);
-			reinsert(st.unit_finder_y, u->unit_finder_bounding_box.from.y, bb.from.y);
+			st.unit_finder_y.reinsert(u, old_bb.to.y, bb.to.y, bb.from.x, bb.to.x, x_changed);
+			st.unit_finder_y.reinsert(u, old_bb.from.y, bb.from.y, bb.from.x, bb.to.x, x_changed);
 		}
 		u->unit_finder_bounding_box = bb;
 	}
@@ -15723,9 +16126,9 @@ void update_units() {
 			using iterator_category = std::forward_iterator_tag;
 		private:
 			const unit_finder_search* search;
-			a_vector<state::unit_finder_entry>::iterator i;
+			unit_finder_axis::iterator i;
 			friend unit_finder_search;
-			iterator(const unit_finder_search* search, a_vector<state::unit_finder_entry>::iterator i) : search(search), i(i) {}
+			iterator(const unit_finder_search* search, unit_finder_axis::iterator i) : search(search), i(i) {}
 			bool in_bounds() {
 				unit_t* u = i->u;
 				if (u->unit_finder_bounding_box.from.x >= search->area.to.x) return false;
@@ -15769,18 +16172,16 @@ void update_units() {
 	private:
 		friend state_functions;
 		const state_functions& funcs;
-		a_vector<state::unit_finder_entry>::iterator i_begin;
-		a_vector<state::unit_finder_entry>::iterator i_end;
+		unit_finder_axis::iterator i_begin;
+		unit_finder_axis::iterator i_end;
 		rect area;
 		size_t search_index;
 		unit_finder_search(const state_functions& funcs, rect area, bool expand) : funcs(funcs), area(area) {
+			OPENBW_PROFILE_ZONE(zone_unit_finder_search_setup);
 			if (funcs.unit_finder_search_index == 4) error("unit_finder_search maximum recursive depth reached");
 			search_index = funcs.unit_finder_search_index;
 			++funcs.unit_finder_search_index;
 
-			auto cmp_l = [&](auto& a, int b) {
-				return a.value < b;
-			};
 			int begin_x = area.from.x;
 			int end_x = area.to.x;
 			if (expand) {
@@ -15792,8 +16193,8 @@ void update_units() {
 					++this->area.to.y;
 				}
 			}
-			i_begin = std::lower_bound(funcs.st.unit_finder_x.begin(), funcs.st.unit_finder_x.end(), begin_x, cmp_l);
-			i_end = std::lower_bound(funcs.st.unit_finder_x.begin(), funcs.st.unit_finder_x.end(), end_x, cmp_l);
+			i_begin = funcs.st.unit_finder_x.lower_bound(begin_x);
+			i_end = funcs.st.unit_finder_x.lower_bound(end_x);
 		}
 	public:
 		~unit_finder_search() {
@@ -15931,12 +16332,8 @@ void update_units() {
 
 	template<typename F>
 	unit_t* find_nearest_unit(xy pos, rect search_area, F&& predicate) const {
-
-		auto cmp_l = [&](auto& a, int b) {
-			return a.value < b;
-		};
-		auto x_i = std::lower_bound(st.unit_finder_x.begin(), st.unit_finder_x.end(), pos.x, cmp_l);
-		auto y_i = std::lower_bound(st.unit_finder_y.begin(), st.unit_finder_y.end(), pos.y, cmp_l);
+		auto x_i = st.unit_finder_x.lower_bound(pos.x);
+		auto y_i = st.unit_finder_y.lower_bound(pos.y);
 
 		return find_nearest_unit(pos, search_area, x_i, y_i, x_i, y_i, predicate);
 	}
@@ -15946,18 +16343,10 @@ void update_units() {
 		if (us_hidden(u)) {
 			return find_nearest_unit(u->sprite->position, search_area, std::forward<F>(predicate));
 		} else {
-			auto cmp_l = [&](auto& a, int b) {
-				return a.value < b;
-			};
-			auto get = [&](auto& vec, int value) {
-				auto i = std::lower_bound(vec.begin(), vec.end(), value, cmp_l);
-				while (i->u != u) ++i;
-				return i;
-			};
-			auto left_i = get(st.unit_finder_x, u->unit_finder_bounding_box.to.x);
-			auto up_i = get(st.unit_finder_y, u->unit_finder_bounding_box.to.y);
-			auto right_i = std::next(get(st.unit_finder_x, u->unit_finder_bounding_box.from.x));
-			auto down_i = std::next(get(st.unit_finder_y, u->unit_finder_bounding_box.from.y));
+			auto left_i = st.unit_finder_x.find(u, u->unit_finder_bounding_box.to.x);
+			auto up_i = st.unit_finder_y.find(u, u->unit_finder_bounding_box.to.y);
+			auto right_i = std::next(st.unit_finder_x.find(u, u->unit_finder_bounding_box.from.x));
+			auto down_i = std::next(st.unit_finder_y.find(u, u->unit_finder_bounding_box.from.y));
 			return find_nearest_unit(u->sprite->position, search_area, left_i, up_i, right_i, down_i, std::forward<F>(predicate));
 		}
 	}
@@ -17138,10 +17527,14 @@ void update_units() {
 		return uy * game_st.repulse_field_width + ux;
 	}
 
-	void increment_repulse_field(unit_t* u) {
-		if (!u_can_move(u)) return;
-		if (ut_building(u)) return;
-		if (unit_is(u, UnitTypes::Protoss_Interceptor)) return;
+	bool unit_uses_repulse_field(const unit_t* u) const {
+		if (!u_can_move(u)) return false;
+		if (ut_building(u)) return false;
+		if (unit_is(u, UnitTypes::Protoss_Interceptor)) return false;
+		return true;
+	}
+
+	void add_to_repulse_field(unit_t* u) {
 		if ((u->repulse_flags & 0xf0) == 0) {
 			unsigned int v = lcg_rand(37);
 			u->repulse_direction = direction_from_index(v & 0xff);
@@ -17155,14 +17548,21 @@ void update_units() {
 		if (v < 0xff) ++v;
 	}
 
-	void decrement_repulse_field(unit_t* u) {
-		if (!u_can_move(u)) return;
-		if (ut_building(u)) return;
-		if (unit_is(u, UnitTypes::Protoss_Interceptor)) return;
+	void remove_from_repulse_field(unit_t* u) {
 		auto& v = st.repulse_field.at(u->repulse_index);
 		if (v > 0) --v;
 	}
 
+	void increment_repulse_field(unit_t* u) {
+		if (!unit_uses_repulse_field(u)) return;
+		add_to_repulse_field(u);
+	}
+
+	void decrement_repulse_field(unit_t* u) {
+		if (!unit_uses_repulse_field(u)) return;
+		remove_from_repulse_field(u);
+	}
+
 	void show_unit(unit_t* u) {
 		if (!us_hidden(u)) return;
 		u->sprite->flags &= ~sprite_t::flag_hidden;
@@ -19022,6 +19422,36 @@ void update_units() {
 		return r;
 	}
 
+	// Bring counts by location, shared between all the conditions tested in
+	// one trigger pass. Conditions do not modify the game state, so the
+	// counts stay valid until a trigger executes its actions.
+	struct trigger_condition_cache {
+		a_deque<bring_unit_counters> bring_counts;
+		a_vector<const bring_unit_counters*> location_bring_counts;
+		void clear() {
+			bring_counts.clear();
+			location_bring_counts.clear();
+		}
+	};
+
+	const bring_unit_counters& cached_trigger_bring_count(trigger_condition_cache& cache, size_t location_index) const {
+		const location& loc = st.locations.at(location_index);
+		if (cache.location_bring_counts.size() <= location_index) cache.location_bring_counts.resize(location_index + 1);
+		auto& r = cache.location_bring_counts[location_index];
+		if (!r) {
+			cache.bring_counts.push_back(trigger_bring_count(loc));
+			r = &cache.bring_counts.back();
+		}
+		return *r;
+	}
+
+	bool test_trigger_condition(const trigger::condition& c, int owner, trigger_condition_cache& cache) const {
+		if (c.type == 3) {
+			return trigger_count_comparison(c, trigger_command_count(cached_trigger_bring_count(cache, c.location - 1), owner, c.group, c.unit_id, c.num_n != 1));
+		}
+		return test_trigger_condition(c, owner);
+	}
+
 	bool test_trigger_condition(const trigger::condition& c, int owner) const {
 		switch (c.type) {
 		case 2: // command
@@ -19549,6 +19979,7 @@ void update_units() {
 		size_t index = tile_pos.y * game_st.map_tile_width + tile_pos.x;
 		if (has_creep) st.tiles[index].flags |= tile_t::flag_has_creep;
 		else st.tiles[index].flags &= ~tile_t::flag_has_creep;
+		on_tile_creep_changed(index);
 
 		size_t width = game_st.map_tile_width;
 		size_t height = game_st.map_tile_height;
@@ -19932,6 +20363,776 @@ static inline state copy_state(const state& st) {
 	return r;
 }
 
+// A snapshot of a state that can only be restored into the same state object
+// it was saved from. Objects keep their addresses across save and restore, so
+// unlike state_copier nothing has to be remapped: object containers are saved
+// as raw copies of their chunks, and chunks whose contents did not change
+// since the previous snapshot are shared with it instead of copied.
+// Paths and thingies live in std::lists and are saved by value.
+// Restoring a snapshot into the state it was saved from (the usual pattern
+// for search rollouts) does no per-object remapping and no hash lookups.
+struct state_snapshot {
+
+	template<typename T>
+	struct raw_copy {
+		std::array<uint8_t, sizeof(T)> data;
+		void save(const T& v) {
+			memcpy(data.data(), (const void*)&v, sizeof(T));
+		}
+		void load(T& v) const {
+			memcpy((void*)&v, data.data(), sizeof(T));
+		}
+	};
+
+	template<typename T, size_t N>
+	struct container_snapshot {
+		using chunk_t = std::array<T, N>;
+		a_vector<std::shared_ptr<const raw_copy<chunk_t>>> chunks;
+		a_vector<const chunk_t*> chunk_addresses;
+		raw_copy<intrusive_list<T, default_link_f>> free_list;
+		size_t size = 0;
+		size_t max_size = 0;
+
+		void save(const object_container<T, N>& cont, const container_snapshot* prev) {
+			size_t n = cont.list.size();
+			chunks.resize(n);
+			chunk_addresses.resize(n);
+			for (size_t i = 0; i != n; ++i) {
+				const chunk_t* chunk = &cont.list[i];
+				chunk_addresses[i] = chunk;
+				if (prev && i < prev->chunks.size() && prev->chunk_addresses[i] == chunk && memcmp(prev->chunks[i]->data.data(), (const void*)chunk, sizeof(chunk_t)) == 0) {
+					chunks[i] = prev->chunks[i];
+				} else {
+					auto v = std::make_shared<raw_copy<chunk_t>>();
+					v->save(*chunk);
+					chunks[i] = std::move(v);
+				}
+			}
+			free_list.save(cont.free_list);
+			size = cont.size;
+			max_size = cont.max_size;
+		}
+
+		void restore(object_container<T, N>& cont) const {
+			if (cont.list.size() < chunks.size()) error("state_snapshot: object container has fewer chunks than the snapshot");
+			for (size_t i = 0; i != chunks.size(); ++i) {
+				if (&cont.list[i] != chunk_addresses[i]) error("state_snapshot: object container chunk %d moved", i);
+				chunks[i]->load(cont.list[i]);
+			}
+			for (size_t i = chunks.size(); i != cont.list.size(); ++i) {
+				chunk_t* chunk = &cont.list[i];
+				chunk->~chunk_t();
+				memset((void*)chunk, 0, sizeof(chunk_t));
+				new (chunk) chunk_t();
+			}
+			free_list.load(cont.free_list);
+			cont.size = size;
+			cont.max_size = max_size;
+		}
+	};
+
+	template<typename T>
+	using address_index = a_vector<std::pair<const T*, size_t>>;
+
+	template<typename T>
+	static size_t find_address(const address_index<T>& index, const T* v) {
+		auto i = std::lower_bound(index.begin(), index.end(), v, [](auto& a, const T* b) {
+			return std::less<const T*>()(a.first, b);
+		});
+		if (i == index.end() || i->first != v) return (size_t)-1;
+		return i->second;
+	}
+
+	template<typename T>
+	struct list_snapshot {
+		a_vector<T> values;
+		a_vector<const T*> addresses;
+
+		void save(const a_list<T>& list) {
+			values.assign(list.begin(), list.end());
+			addresses.clear();
+			for (auto& v : list) addresses.push_back(&v);
+		}
+
+		address_index<T> index() const {
+			address_index<T> r;
+			for (size_t i = 0; i != addresses.size(); ++i) r.emplace_back(addresses[i], i);
+			std::sort(r.begin(), r.end(), [](auto& a, auto& b) {
+				return std::less<const T*>()(a.first, b.first);
+			});
+			return r;
+		}
+
+		// Nodes that are still at the address they had when the snapshot was
+		// saved are overwritten in place, and nodes added since are removed.
+		// Otherwise the list is rebuilt and the function returns false, in
+		// which case pointers into it must be remapped through addresses.
+		bool restore(a_list<T>& list, a_vector<T*>& nodes) const {
+			nodes.clear();
+			bool in_place = list.size() >= values.size();
+			if (in_place) {
+				auto i = list.begin();
+				for (size_t n = 0; n != values.size(); ++n, ++i) {
+					if (&*i != addresses[n]) {
+						in_place = false;
+						break;
+					}
+				}
+			}
+			if (in_place) {
+				auto i = list.begin();
+				for (size_t n = 0; n != values.size(); ++n, ++i) {
+					*i = values[n];
+					nodes.push_back(&*i);
+				}
+				list.erase(i, list.end());
+			} else {
+				list.clear();
+				for (auto& v : values) {
+					list.push_back(v);
+					nodes.push_back(&list.back());
+				}
+			}
+			return in_place;
+		}
+	};
+
+	const state* source = nullptr;
+	int current_frame = 0;
+
+	state_base_copyable copyable;
+
+	raw_copy<intrusive_list<unit_t, default_link_f>> visible_units;
+	raw_copy<intrusive_list<unit_t, default_link_f>> hidden_units;
+	raw_copy<intrusive_list<unit_t, default_link_f>> map_revealer_units;
+	raw_copy<intrusive_list<unit_t, default_link_f>> dead_units;
+	raw_copy<decltype(state::player_units)> player_units;
+	raw_copy<decltype(state::cloaked_units)> cloaked_units;
+	raw_copy<decltype(state::psionic_matrix_units)> psionic_matrix_units;
+	raw_copy<intrusive_list<bullet_t, default_link_f>> active_bullets;
+	a_vector<raw_copy<intrusive_list<sprite_t, default_link_f>>> sprites_on_tile_line;
+
+	container_snapshot<unit_t, 17> units_container;
+	container_snapshot<bullet_t, 10> bullets_container;
+	container_snapshot<sprite_t, 25> sprites_container;
+	container_snapshot<image_t, 50> images_container;
+	container_snapshot<order_t, 20> orders_container;
+
+	list_snapshot<path_t> paths;
+	a_vector<size_t> free_paths;
+
+	list_snapshot<thingy_t> thingies;
+	a_vector<size_t> active_thingies;
+	a_vector<size_t> free_thingies;
+
+	unit_finder_axis unit_finder_x;
+	unit_finder_axis unit_finder_y;
+
+	const unit_t* consider_collision_with_unit_bug = nullptr;
+	const unit_t* prev_bullet_source_unit = nullptr;
+
+	// prev is the snapshot to share unchanged chunks with. It should be
+	// a snapshot of the same state, usually the most recent one.
+	void save(const state& st, const state_snapshot* prev = nullptr) {
+		if (prev && prev->source != &st) prev = nullptr;
+		source = &st;
+		current_frame = st.current_frame;
+		copyable = (const state_base_copyable&)st;
+
+		visible_units.save(st.visible_units);
+		hidden_units.save(st.hidden_units);
+		map_revealer_units.save(st.map_revealer_units);
+		dead_units.save(st.dead_units);
+		player_units.save(st.player_units);
+		cloaked_units.save(st.cloaked_units);
+		psionic_matrix_units.save(st.psionic_matrix_units);
+		active_bullets.save(st.active_bullets);
+		sprites_on_tile_line.resize(st.sprites_on_tile_line.size());
+		for (size_t i = 0; i != sprites_on_tile_line.size(); ++i) {
+			sprites_on_tile_line[i].save(st.sprites_on_tile_line[i]);
+		}
+
+		units_container.save(st.units_container, prev ? &prev->units_container : nullptr);
+		bullets_container.save(st.bullets_container, prev ? &prev->bullets_container : nullptr);
+		sprites_container.save(st.sprites_container, prev ? &prev->sprites_container : nullptr);
+		images_container.save(st.images_container, prev ? &prev->images_container : nullptr);
+		orders_container.save(st.orders_container, prev ? &prev->orders_container : nullptr);
+
+		auto list_indices = [&](auto& r, const auto& index, auto& list) {
+			r.clear();
+			for (auto& v : list) {
+				size_t n = find_address(index, &v);
+				if (n == (size_t)-1) error("state_snapshot: list entry is not in the owning list");
+				r.push_back(n);
+			}
+		};
+		paths.save(st.paths);
+		list_indices(free_paths, paths.index(), st.free_paths);
+		thingies.save(st.thingies);
+		auto thingy_index = thingies.index();
+		list_indices(active_thingies, thingy_index, st.active_thingies);
+		list_indices(free_thingies, thingy_index, st.free_thingies);
+
+		unit_finder_x = st.unit_finder_x;
+		unit_finder_y = st.unit_finder_y;
+
+		consider_collision_with_unit_bug = st.consider_collision_with_unit_bug;
+		prev_bullet_source_unit = st.prev_bullet_source_unit;
+	}
+
+	void restore(state& st) const {
+		if (source != &st) error("state_snapshot: attempt to restore into a different state");
+		(state_base_copyable&)st = copyable;
+
+		visible_units.load(st.visible_units);
+		hidden_units.load(st.hidden_units);
+		map_revealer_units.load(st.map_revealer_units);
+		dead_units.load(st.dead_units);
+		player_units.load(st.player_units);
+		cloaked_units.load(st.cloaked_units);
+		psionic_matrix_units.load(st.psionic_matrix_units);
+		active_bullets.load(st.active_bullets);
+		if (st.sprites_on_tile_line.size() != sprites_on_tile_line.size()) error("state_snapshot: sprites_on_tile_line size mismatch");
+		for (size_t i = 0; i != sprites_on_tile_line.size(); ++i) {
+			sprites_on_tile_line[i].load(st.sprites_on_tile_line[i]);
+		}
+
+		units_container.restore(st.units_container);
+		bullets_container.restore(st.bullets_container);
+		sprites_container.restore(st.sprites_container);
+		images_container.restore(st.images_container);
+		orders_container.restore(st.orders_container);
+
+		a_vector<path_t*> new_paths;
+		st.free_paths.clear();
+		bool paths_in_place = paths.restore(st.paths, new_paths);
+		for (size_t i : free_paths) st.free_paths.push_back(*new_paths[i]);
+
+		a_vector<thingy_t*> new_thingies;
+		st.active_thingies.clear();
+		st.free_thingies.clear();
+		bool thingies_in_place = thingies.restore(st.thingies, new_thingies);
+		for (size_t i : active_thingies) st.active_thingies.push_back(*new_thingies[i]);
+		for (size_t i : free_thingies) st.free_thingies.push_back(*new_thingies[i]);
+
+		if (!paths_in_place || !thingies_in_place) {
+			auto path_index = paths.index();
+			auto thingy_index = thingies.index();
+			state_functions funcs(st);
+			auto remap = [&](auto& index, auto& nodes, auto*& v) {
+				if (!v) return;
+				size_t n = find_address(index, v);
+				if (n != (size_t)-1) v = nodes[n];
+			};
+			auto remap_units = [&](auto& list) {
+				for (unit_t* u : ptr(list)) {
+					if (!paths_in_place) remap(path_index, new_paths, u->path);
+					if (!thingies_in_place && u->unit_type && funcs.unit_is_ghost(u)) remap(thingy_index, new_thingies, u->ghost.nuke_dot);
+				}
+			};
+			remap_units(st.visible_units);
+			remap_units(st.hidden_units);
+			remap_units(st.map_revealer_units);
+			remap_units(st.dead_units);
+			remap_units(st.units_container.free_list);
+		}
+
+		st.unit_finder_x = unit_finder_x;
+		st.unit_finder_y = unit_finder_y;
+
+		st.consider_collision_with_unit_bug = consider_collision_with_unit_bug;
+		st.prev_bullet_source_unit = prev_bullet_source_unit;
+	}
+};
+
+
+// Walks every piece of simulation state in a deterministic order and reports
+// it to a sink as (name, value) fields grouped into objects. Pointers are
+// reported as the index or type id of what they point to, so the result does
+// not depend on where the objects live in memory, and state that is only
+// touched by the UI (selection, redraw flags) is left out. state_hasher uses
+// this to hash a state; the sink interface also allows dumping it field by
+// field to find out what differs between two states.
+//
+// A sink provides
+//   void begin_object(const char* kind, size_t index);
+//   void field(const char* name, uint64_t value);
+//   void end_object();
+template<typename sink_T>
+struct state_hash_visitor {
+	const state& st;
+	state_functions funcs;
+	sink_T& sink;
+	// Only const members of state_functions are used.
+	state_hash_visitor(const state& st, sink_T& sink) : st(st), funcs(const_cast<state&>(st)), sink(sink) {}
+
+	void field(const char* name, uint64_t value) {
+		sink.field(name, value);
+	}
+	template<typename T>
+	void field(const char* name, xy_t<T> value) {
+		field(name, (uint64_t)(uint32_t)value.x << 32 | (uint32_t)value.y);
+	}
+	template<typename T>
+	void field(const char* name, rect_t<T> value) {
+		field(name, value.from);
+		field(name, value.to);
+	}
+	template<typename T>
+	void fp_field(const char* name, T value) {
+		field(name, (uint64_t)value.raw_value);
+	}
+	template<typename T>
+	void fp_field(const char* name, xy_t<T> value) {
+		field(name, (uint64_t)(uint32_t)value.x.raw_value << 32 | (uint32_t)value.y.raw_value);
+	}
+	template<typename T>
+	void id_field(const char* name, const T* p) {
+		field(name, p ? (uint64_t)p->id : ~(uint64_t)0);
+	}
+	template<typename T>
+	void index_field(const char* name, const T* p) {
+		field(name, p ? (uint64_t)p->index : ~(uint64_t)0);
+	}
+	template<typename list_T>
+	void list_field(const char* name, const list_T& list) {
+		size_t n = 0;
+		for (auto& v : list) {
+			index_field(name, &v);
+			++n;
+		}
+		field(name, n);
+	}
+
+	void visit_globals() {
+		sink.begin_object("state", 0);
+		field("update_tiles_countdown", st.update_tiles_countdown);
+		field("order_timer_counter", st.order_timer_counter);
+		field("secondary_order_timer_counter", st.secondary_order_timer_counter);
+		field("current_frame", st.current_frame);
+		for (auto& v : st.players) {
+			field("player.controller", v.controller);
+			field("player.race", (uint64_t)v.race);
+			field("player.force", v.force);
+			field("player.color", v.color);
+			field("player.initially_active", v.initially_active);
+			field("player.victory_state", v.victory_state);
+		}
+		for (auto& a : st.alliances) for (auto v : a) field("alliances", v);
+		for (auto& a : st.upgrade_levels) for (auto v : a) field("upgrade_levels", v);
+		for (auto& a : st.upgrade_upgrading) for (auto v : a) field("upgrade_upgrading", v);
+		for (auto& a : st.tech_researched) for (auto v : a) field("tech_researched", v);
+		for (auto& a : st.tech_researching) for (auto v : a) field("tech_researching", v);
+		for (auto& a : st.unit_counts) for (auto v : a) field("unit_counts", v);
+		for (auto& a : st.completed_unit_counts) for (auto v : a) field("completed_unit_counts", v);
+		for (size_t i = 0; i != 12; ++i) {
+			field("factory_counts", st.factory_counts[i]);
+			field("building_counts", st.building_counts[i]);
+			field("non_building_counts", st.non_building_counts[i]);
+			field("completed_factory_counts", st.completed_factory_counts[i]);
+			field("completed_building_counts", st.completed_building_counts[i]);
+			field("completed_non_building_counts", st.completed_non_building_counts[i]);
+			field("total_buildings_ever_completed", st.total_buildings_ever_completed[i]);
+			field("total_non_buildings_ever_completed", st.total_non_buildings_ever_completed[i]);
+			field("unit_score", st.unit_score[i]);
+			field("building_score", st.building_score[i]);
+			for (auto v : st.supply_used[i]) fp_field("supply_used", v);
+			for (auto v : st.supply_available[i]) fp_field("supply_available", v);
+			field("shared_vision", st.shared_vision[i]);
+			field("trigger_wait_timers", st.trigger_wait_timers[i]);
+			field("trigger_waiting", st.trigger_waiting[i]);
+			field("current_minerals", st.current_minerals[i]);
+			field("current_gas", st.current_gas[i]);
+			field("total_minerals_gathered", st.total_minerals_gathered[i]);
+			field("total_gas_gathered", st.total_gas_gathered[i]);
+		}
+		for (auto v : st.random_counts) field("random_counts", v);
+		field("total_random_counts", st.total_random_counts);
+		field("lcg_rand_state", st.lcg_rand_state);
+		field("last_error", st.last_error);
+		field("trigger_timer", st.trigger_timer);
+		for (auto& list : st.running_triggers) {
+			field("running_triggers", list.size());
+			for (auto& v : list) {
+				field("running_trigger.t", v.t ? (uint64_t)(v.t - st.game->triggers.data()) : ~(uint64_t)0);
+				field("running_trigger.flags", v.flags);
+				field("running_trigger.current_action_index", v.current_action_index);
+				for (auto& a : v.actions) field("running_trigger.action.flags", a.flags);
+			}
+		}
+		field("active_orders_size", st.active_orders_size);
+		field("active_bullets_size", st.active_bullets_size);
+		field("active_thingies_size", st.active_thingies_size);
+		field("prev_bullet_heading_offset_clockwise", st.prev_bullet_heading_offset_clockwise);
+		for (auto& hits : st.recent_lurker_hits) {
+			field("recent_lurker_hits", hits.size());
+			for (auto& v : hits) field("recent_lurker_hits", (uint64_t)v.first << 32 | v.second);
+		}
+		field("recent_lurker_hit_current_index", st.recent_lurker_hit_current_index);
+		field("update_psionic_matrix", st.update_psionic_matrix);
+		field("disruption_webbed_units", st.disruption_webbed_units);
+		field("cheats_enabled", st.cheats_enabled);
+		field("cheat_operation_cwal", st.cheat_operation_cwal);
+		for (auto& v : st.locations) {
+			field("location.area", v.area);
+			field("location.elevation_flags", v.elevation_flags);
+		}
+		sink.end_object();
+
+		sink.begin_object("tiles", 0);
+		for (auto& v : st.tiles) field("tile", (uint64_t)v.visible | (uint64_t)v.explored << 8 | (uint64_t)v.flags << 16);
+		for (auto v : st.tiles_mega_tile_index) field("tiles_mega_tile_index", v);
+		for (auto v : st.repulse_field) field("repulse_field", v);
+		sink.end_object();
+
+		sink.begin_object("creep_life", 0);
+		auto& cl = st.creep_life;
+		auto entry_index = [&](auto& v) {
+			return (uint64_t)(&v - cl.entry_container.data());
+		};
+		field("recede_timer", cl.recede_timer);
+		field("check_dead_unit_timer", cl.check_dead_unit_timer);
+		for (auto& v : cl.entry_container) {
+			field("entry.tile_pos", v.tile_pos);
+			field("entry.n_neighboring_creep_tiles", v.n_neighboring_creep_tiles);
+		}
+		for (size_t i = 0; i != cl.lists.size(); ++i) {
+			field("lists_size", cl.lists_size[i]);
+			for (auto& v : cl.lists[i]) field("list", entry_index(v));
+		}
+		field("free_list_size", cl.free_list_size);
+		for (auto& v : cl.free_list) field("free_list", entry_index(v));
+		for (auto& b : cl.table.buckets) {
+			for (auto& v : b) field("table", entry_index(v));
+		}
+		sink.end_object();
+
+		// The order of the free lists decides which index the next object
+		// gets, and the unit finder order decides the order searches visit
+		// units in, so both are part of the simulation state.
+		sink.begin_object("containers", 0);
+		list_field("units_container.free_list", st.units_container.free_list);
+		list_field("images_container.free_list", st.images_container.free_list);
+		list_field("sprites_container.free_list", st.sprites_container.free_list);
+		list_field("bullets_container.free_list", st.bullets_container.free_list);
+		list_field("orders_container.free_list", st.orders_container.free_list);
+		field("free_thingies", std::distance(st.free_thingies.begin(), st.free_thingies.end()));
+		field("free_paths", std::distance(st.free_paths.begin(), st.free_paths.end()));
+		sink.end_object();
+
+		sink.begin_object("unit_finder", 0);
+		for (auto& b : st.unit_finder_x.buckets) {
+			for (auto& v : b) field("x", (uint64_t)v.u->index << 32 | (uint32_t)v.value);
+		}
+		for (auto& b : st.unit_finder_y.buckets) {
+			for (auto& v : b) field("y", (uint64_t)v.u->index << 32 | (uint32_t)v.value);
+		}
+		sink.end_object();
+	}
+
+	void visit_flingy(const flingy_t* f) {
+		fp_field("hp", f->hp);
+		index_field("sprite", f->sprite);
+		field("move_target.pos", f->move_target.pos);
+		index_field("move_target.unit", f->move_target.unit);
+		field("next_movement_waypoint", f->next_movement_waypoint);
+		field("next_target_waypoint", f->next_target_waypoint);
+		field("movement_flags", f->movement_flags);
+		fp_field("heading", f->heading);
+		fp_field("flingy_turn_rate", f->flingy_turn_rate);
+		fp_field("next_velocity_direction", f->next_velocity_direction);
+		id_field("flingy_type", f->flingy_type);
+		field("flingy_movement_type", f->flingy_movement_type);
+		field("position", f->position);
+		fp_field("exact_position", f->exact_position);
+		fp_field("flingy_top_speed", f->flingy_top_speed);
+		fp_field("current_speed", f->current_speed);
+		fp_field("next_speed", f->next_speed);
+		fp_field("velocity", f->velocity);
+		fp_field("flingy_acceleration", f->flingy_acceleration);
+		fp_field("current_velocity_direction", f->current_velocity_direction);
+		fp_field("desired_velocity_direction", f->desired_velocity_direction);
+		field("order_signal", f->order_signal);
+	}
+
+	void visit_path(const path_t* p) {
+		field("path.delay", p->delay);
+		field("path.creation_frame", p->creation_frame);
+		field("path.state_flags", p->state_flags);
+		field("path.long_path", p->long_path.size());
+		for (size_t i = 0; i != p->long_path.size(); ++i) index_field("path.long_path", p->long_path[i]);
+		field("path.full_long_path_size", p->full_long_path_size);
+		field("path.short_path", p->short_path.size());
+		for (size_t i = 0; i != p->short_path.size(); ++i) field("path.short_path", p->short_path[i]);
+		field("path.current_long_path_index", p->current_long_path_index);
+		field("path.current_short_path_index", p->current_short_path_index);
+		field("path.source", p->source);
+		field("path.destination", p->destination);
+		field("path.next", p->next);
+		field("path.last_collision_unit", p->last_collision_unit.raw_value);
+		fp_field("path.last_collision_speed", p->last_collision_speed);
+		fp_field("path.slide_free_direction", p->slide_free_direction);
+	}
+
+	void visit_unit(const unit_t* u, int list) {
+		sink.begin_object("unit", u->index);
+		field("list", list);
+		visit_flingy(u);
+		field("owner", u->owner);
+		id_field("order_type", u->order_type);
+		field("order_state", u->order_state);
+		id_field("order_unit_type", u->order_unit_type);
+		field("main_order_timer", u->main_order_timer);
+		field("ground_weapon_cooldown", u->ground_weapon_cooldown);
+		field("air_weapon_cooldown", u->air_weapon_cooldown);
+		field("spell_cooldown", u->spell_cooldown);
+		field("order_target.pos", u->order_target.pos);
+		index_field("order_target.unit", u->order_target.unit);
+		fp_field("shield_points", u->shield_points);
+		id_field("unit_type", u->unit_type);
+		index_field("subunit", u->subunit);
+		for (auto& o : u->order_queue) {
+			index_field("order_queue", &o);
+			id_field("order_queue.order_type", o.order_type);
+			field("order_queue.target.position", o.target.position);
+			index_field("order_queue.target.unit", o.target.unit);
+			id_field("order_queue.target.unit_type", o.target.unit_type);
+		}
+		index_field("auto_target_unit", u->auto_target_unit);
+		index_field("connected_unit", u->connected_unit);
+		field("order_queue_count", u->order_queue_count);
+		field("order_process_timer", u->order_process_timer);
+		field("unknown_0x086", u->unknown_0x086);
+		field("attack_notify_timer", u->attack_notify_timer);
+		id_field("previous_unit_type", u->previous_unit_type);
+		field("last_event_timer", u->last_event_timer);
+		field("last_event_color", u->last_event_color);
+		field("rank_increase", u->rank_increase);
+		field("kill_count", u->kill_count);
+		field("last_attacking_player", u->last_attacking_player);
+		field("secondary_order_timer", u->secondary_order_timer);
+		field("user_action_flags", u->user_action_flags);
+		field("cloak_counter", u->cloak_counter);
+		field("movement_state", u->movement_state);
+		field("build_queue", u->build_queue.size());
+		for (auto* v : u->build_queue) id_field("build_queue", v);
+		fp_field("energy", u->energy);
+		field("unit_id_generation", u->unit_id_generation);
+		id_field("secondary_order_type", u->secondary_order_type);
+		field("damage_overlay_state", u->damage_overlay_state);
+		fp_field("hp_construction_rate", u->hp_construction_rate);
+		fp_field("shield_construction_rate", u->shield_construction_rate);
+		field("remaining_build_time", u->remaining_build_time);
+		field("previous_hp", u->previous_hp);
+		for (auto v : u->loaded_units) field("loaded_units", v.raw_value);
+		if (u->unit_type) {
+			if (funcs.unit_is(u, UnitTypes::Protoss_Interceptor) || funcs.unit_is(u, UnitTypes::Protoss_Scarab)) {
+				index_field("fighter.parent", u->fighter.parent);
+				field("fighter.is_outside", u->fighter.is_outside);
+			} else if (funcs.unit_is_carrier(u) || funcs.unit_is_reaver(u)) {
+				list_field("carrier.inside_units", u->carrier.inside_units);
+				list_field("carrier.outside_units", u->carrier.outside_units);
+				field("carrier.inside_count", u->carrier.inside_count);
+				field("carrier.outside_count", u->carrier.outside_count);
+			} else if (funcs.unit_is_ghost(u)) {
+				field("ghost.nuke_dot", u->ghost.nuke_dot != nullptr);
+			} else if (funcs.unit_is_vulture(u)) {
+				field("vulture.spider_mine_count", u->vulture.spider_mine_count);
+			} else if (funcs.unit_is_non_flag_beacon(u) || funcs.unit_is_special_beacon(u)) {
+				field("beacon.flag_spawn_frame", u->beacon.flag_spawn_frame);
+			}
+		}
+		index_field("worker.powerup", u->worker.powerup);
+		field("worker.target_resource_position", u->worker.target_resource_position);
+		index_field("worker.target_resource_unit", u->worker.target_resource_unit);
+		field("worker.repair_timer", u->worker.repair_timer);
+		field("worker.is_gathering", u->worker.is_gathering);
+		field("worker.resources_carried", u->worker.resources_carried);
+		index_field("worker.gather_target", u->worker.gather_target);
+		index_field("building.addon", u->building.addon);
+		id_field("building.addon_build_type", u->building.addon_build_type);
+		field("building.upgrade_research_time", u->building.upgrade_research_time);
+		id_field("building.researching_type", u->building.researching_type);
+		id_field("building.upgrading_type", u->building.upgrading_type);
+		field("building.larva_timer", u->building.larva_timer);
+		field("building.is_landing", u->building.is_landing);
+		field("building.creep_timer", u->building.creep_timer);
+		field("building.upgrading_level", u->building.upgrading_level);
+		field("building.rally.pos", u->building.rally.pos);
+		index_field("building.rally.unit", u->building.rally.unit);
+		if (u->unit_type) {
+			if (funcs.ut_resource(u)) {
+				field("resource.resource_count", u->building.resource.resource_count);
+				field("resource.resource_iscript", u->building.resource.resource_iscript);
+				field("resource.is_being_gathered", u->building.resource.is_being_gathered);
+				list_field("resource.gather_queue", u->building.resource.gather_queue);
+			} else if (funcs.unit_is_nydus(u)) {
+				index_field("nydus.exit", u->building.nydus.exit);
+			} else if (funcs.unit_is(u, UnitTypes::Terran_Nuclear_Silo)) {
+				index_field("silo.nuke", u->building.silo.nuke);
+				field("silo.ready", u->building.silo.ready);
+			} else if (funcs.unit_is(u, UnitTypes::Protoss_Pylon)) {
+				index_field("pylon.psi_field_sprite", u->building.pylon.psi_field_sprite);
+			} else if (funcs.unit_is_hatchery(u)) {
+				for (auto v : u->building.hatchery.larva_spawn_side_values) field("hatchery.larva_spawn_side_values", v);
+			}
+		}
+		field("status_flags", u->status_flags);
+		field("carrying_flags", u->carrying_flags);
+		field("wireframe_randomizer", u->wireframe_randomizer);
+		field("secondary_order_state", u->secondary_order_state);
+		field("move_target_timer", u->move_target_timer);
+		field("detected_flags", u->detected_flags);
+		index_field("current_build_unit", u->current_build_unit);
+		if (u->path) visit_path(u->path);
+		field("pathing_collision_counter", u->pathing_collision_counter);
+		field("pathing_flags", u->pathing_flags);
+		field("unused_0x106", u->unused_0x106);
+		field("is_being_healed", u->is_being_healed);
+		field("terrain_no_collision_bounds", u->terrain_no_collision_bounds);
+		field("remove_timer", u->remove_timer);
+		fp_field("defensive_matrix_hp", u->defensive_matrix_hp);
+		field("defensive_matrix_timer", u->defensive_matrix_timer);
+		field("stim_timer", u->stim_timer);
+		field("ensnare_timer", u->ensnare_timer);
+		field("lockdown_timer", u->lockdown_timer);
+		field("irradiate_timer", u->irradiate_timer);
+		field("stasis_timer", u->stasis_timer);
+		field("plague_timer", u->plague_timer);
+		field("storm_timer", u->storm_timer);
+		index_field("irradiated_by", u->irradiated_by);
+		field("irradiate_owner", u->irradiate_owner);
+		field("parasite_flags", u->parasite_flags);
+		field("cycle_counter", u->cycle_counter);
+		field("blinded_by", u->blinded_by);
+		field("maelstrom_timer", u->maelstrom_timer);
+		field("acid_spore_count", u->acid_spore_count);
+		for (auto v : u->acid_spore_time) field("acid_spore_time", v);
+		field("next_hit_near_target_position_index", u->next_hit_near_target_position_index);
+		field("air_strength", u->air_strength);
+		field("ground_strength", u->ground_strength);
+		field("repulse_flags", u->repulse_flags);
+		fp_field("repulse_direction", u->repulse_direction);
+		field("repulse_index", u->repulse_index);
+		field("unit_finder_bounding_box", u->unit_finder_bounding_box);
+		sink.end_object();
+	}
+
+	void visit_bullet(const bullet_t* b) {
+		sink.begin_object("bullet", b->index);
+		visit_flingy(b);
+		field("bullet_state", b->bullet_state);
+		index_field("bullet_target", b->bullet_target);
+		field("bullet_target_pos", b->bullet_target_pos);
+		id_field("weapon_type", b->weapon_type);
+		field("remaining_time", b->remaining_time);
+		field("hit_flags", b->hit_flags);
+		field("remaining_bounces", b->remaining_bounces);
+		field("owner", b->owner);
+		index_field("bullet_owner_unit", b->bullet_owner_unit);
+		index_field("prev_bounce_unit", b->prev_bounce_unit);
+		field("hit_near_target_position_index", b->hit_near_target_position_index);
+		sink.end_object();
+	}
+
+	void visit_image(const image_t* image) {
+		sink.begin_object("image", image->index);
+		id_field("image_type", image->image_type);
+		field("modifier", image->modifier);
+		field("modifier_data1", image->modifier_data1);
+		field("modifier_data2", image->modifier_data2);
+		field("frame_index", image->frame_index);
+		field("frame_index_base", image->frame_index_base);
+		field("frame_index_offset", image->frame_index_offset);
+		field("flags", image->flags & ~image_t::flag_redraw);
+		field("offset", image->offset);
+		id_field("iscript_state.current_script", image->iscript_state.current_script);
+		field("iscript_state.program_counter", image->iscript_state.program_counter);
+		field("iscript_state.return_address", image->iscript_state.return_address);
+		field("iscript_state.animation", image->iscript_state.animation);
+		field("iscript_state.wait", image->iscript_state.wait);
+		index_field("sprite", image->sprite);
+		field("frozen_y_value", image->frozen_y_value);
+		sink.end_object();
+	}
+
+	void visit_sprite(const sprite_t* sprite, size_t line) {
+		sink.begin_object("sprite", sprite->index);
+		field("line", line);
+		id_field("sprite_type", sprite->sprite_type);
+		field("owner", sprite->owner);
+		field("visibility_flags", sprite->visibility_flags);
+		field("elevation_level", sprite->elevation_level);
+		field("flags", sprite->flags & ~sprite_t::flag_selected);
+		field("width", sprite->width);
+		field("height", sprite->height);
+		field("position", sprite->position);
+		index_field("main_image", sprite->main_image);
+		list_field("images", sprite->images);
+		sink.end_object();
+		for (auto* image : ptr(sprite->images)) visit_image(image);
+	}
+
+	void visit_thingy(const thingy_t* t, size_t index) {
+		sink.begin_object("thingy", index);
+		fp_field("hp", t->hp);
+		index_field("sprite", t->sprite);
+		sink.end_object();
+	}
+
+	void visit() {
+		visit_globals();
+		for (const unit_t* u : ptr(st.visible_units)) visit_unit(u, 0);
+		for (const unit_t* u : ptr(st.hidden_units)) visit_unit(u, 1);
+		for (const unit_t* u : ptr(st.map_revealer_units)) visit_unit(u, 2);
+		for (const unit_t* u : ptr(st.dead_units)) visit_unit(u, 3);
+		for (const bullet_t* b : ptr(st.active_bullets)) visit_bullet(b);
+		for (size_t i = 0; i != st.sprites_on_tile_line.size(); ++i) {
+			for (const sprite_t* sprite : ptr(st.sprites_on_tile_line[i])) visit_sprite(sprite, i);
+		}
+		size_t thingy_index = 0;
+		for (const thingy_t* t : ptr(st.active_thingies)) visit_thingy(t, thingy_index++);
+	}
+};
+
+// Hash of the entire simulation state. Besides the total, the hash of every
+// object is kept (in visiting order) so two states can be compared object by
+// object.
+struct state_hasher {
+	struct object_hash {
+		const char* kind;
+		size_t index;
+		uint64_t hash;
+	};
+	uint64_t hash = 0;
+	a_vector<object_hash> objects;
+
+	void compute(const state& st) {
+		objects.clear();
+		hash = 0xcbf29ce484222325;
+		state_hash_visitor<state_hasher> visitor(st, *this);
+		visitor.visit();
+	}
+
+	uint64_t object_h = 0;
+	void begin_object(const char* kind, size_t index) {
+		objects.push_back({kind, index, 0});
+		object_h = 0xcbf29ce484222325;
+	}
+	void field(const char*, uint64_t value) {
+		object_h = (object_h ^ value) * 0x100000001b3;
+	}
+	void end_object() {
+		objects.back().hash = object_h;
+		hash = (hash ^ object_h) * 0x100000001b3;
+	}
+};
+
+static inline uint64_t state_hash(const state& st) {
+	state_hasher h;
+	h.compute(st);
+	return h.hash;
+}
 
 struct game_load_functions : state_functions {
 
@@ -20169,6 +21370,11 @@ struct game_load_functions : state_functions {
 		game_st.max_unit_width = max_unit_width;
 		game_st.max_unit_height = max_unit_height;
 
+		st.unit_finder_x.reset(game_st.map_width, max_unit_width);
+		st.unit_finder_y.reset(game_st.map_height, max_unit_height);
+		st.long_path_cache.clear();
+		st.sight_mask_cache.clear();
+
 		st.random_counts = {};
 		st.total_random_counts = 0;
 		st.lcg_rand_state = 42;
@@ -6,9 +6,21 @@
 #include "data_types.h"
 
 #include <type_traits>
+#include <algorithm>
 #include <array>
 #include <cstring>
 #include <cstdio>
+#include <exception>
+#ifndef EMSCRIPTEN
+#include <thread>
+#endif
+
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(EMSCRIPTEN)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace bwgame {
 namespace data_loading {
@@ -290,6 +302,114 @@ struct file_reader {
 
 };
 
+// Slicing-by-8: table[k][i] is the crc of byte i followed by k zero bytes,
+// so eight input bytes can be folded in with eight independent lookups.
+struct crc32_t {
+	std::array<std::array<uint32_t, 256>, 8> table;
+	crc32_t() {
+		for (uint32_t i = 0; i != 256; ++i) {
+			uint32_t v = i;
+			for (size_t b = 0; b != 8; ++b) {
+				v = (v >> 1) ^ (v & 1 ? 0xedb88320 : 0);
+			}
+			table[0][i] = v;
+		}
+		for (size_t k = 1; k != 8; ++k) {
+			for (size_t i = 0; i != 256; ++i) {
+				uint32_t v = table[k - 1][i];
+				table[k][i] = (v >> 8) ^ table[0][v & 0xff];
+			}
+		}
+	}
+	uint32_t operator()(const uint8_t* data, size_t data_size) const {
+		return update(begin(), data, data_size);
+	}
+	// For computing the crc of data in several pieces: update(update(begin(),
+	// a, a_size), b, b_size) is the crc of a followed by b.
+	uint32_t begin() const {
+		return 0xffffffff;
+	}
+	uint32_t update(uint32_t r, const uint8_t* data, size_t data_size) const {
+		const uint8_t* end = data + data_size;
+		for (; end - data >= 8; data += 8) {
+			uint32_t lo = r ^ ((uint32_t)data[0] | (uint32_t)data[1] << 8 | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24);
+			r = table[7][lo & 0xff] ^ table[6][(lo >> 8) & 0xff] ^ table[5][(lo >> 16) & 0xff] ^ table[4][lo >> 24];
+			r ^= table[3][data[4]] ^ table[2][data[5]] ^ table[1][data[6]] ^ table[0][data[7]];
+		}
+		for (; data != end; ++data) {
+			r = (r >> 8) ^ table[0][(r ^ *data) & 0xff];
+		}
+		return r;
+	}
+};
+
+// The whole contents of a file, memory mapped where that is available and
+// read into memory otherwise. Readers can then be created over data() without
+// any further copies or per-read calls into the C library.
+struct mapped_file {
+	a_string filename;
+	const uint8_t* ptr = nullptr;
+	size_t file_size = 0;
+	a_vector<uint8_t> buffer;
+	bool mapped = false;
+
+	mapped_file() = default;
+	explicit mapped_file(a_string filename) {
+		open(std::move(filename));
+	}
+	~mapped_file() {
+		close();
+	}
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	void open(a_string filename) {
+		close();
+		this->filename = std::move(filename);
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(EMSCRIPTEN)
+		int fd = ::open(this->filename.c_str(), O_RDONLY);
+		if (fd == -1) error("mapped_file: failed to open %s for reading", this->filename);
+		struct stat s;
+		if (fstat(fd, &s) != 0) {
+			::close(fd);
+			error("mapped_file: %s: stat failed", this->filename);
+		}
+		file_size = (size_t)s.st_size;
+		if (file_size) {
+			void* p = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (p != MAP_FAILED) {
+				ptr = (const uint8_t*)p;
+				mapped = true;
+			}
+		}
+		::close(fd);
+		if (mapped || !file_size) return;
+#endif
+		file_reader<> r(this->filename);
+		buffer.resize(r.size());
+		if (!buffer.empty()) r.get_bytes(buffer.data(), buffer.size());
+		ptr = buffer.data();
+		file_size = buffer.size();
+	}
+
+	void close() {
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(EMSCRIPTEN)
+		if (mapped) munmap((void*)ptr, file_size);
+#endif
+		mapped = false;
+		ptr = nullptr;
+		file_size = 0;
+		buffer.clear();
+	}
+
+	const uint8_t* data() const {
+		return ptr;
+	}
+	size_t size() const {
+		return file_size;
+	}
+};
+
 using crypt_table_t = std::array<uint32_t, 256 * 5>;
 static auto get_crypt_table() {
 	uint32_t n = 0x100001;
@@ -448,222 +568,330 @@ auto make_bit_reader(base_reader_T& reader) {
 	return bit_reader<base_reader_T, little_endian>(reader);
 }
 
-template<bool little_endian = true>
-void decompress(uint8_t* input, size_t input_size, uint8_t* output, size_t output_size) {
-	data_reader<little_endian> source_r(input, input + input_size);
-	auto r = make_bit_reader(source_r);
-	int type = r.template get<uint8_t>();
-	int distance_bits = r.template get<uint8_t>();
-
-	if (distance_bits != 4 && distance_bits != 5 && distance_bits != 6) error("decompress: invalid distance bits %d", distance_bits);
-
-	auto get_length = [&]() {
-		switch (r.template get_bits<2>()) {
-		case 3: return 1;
-		case 0:
-			switch (r.template get_bits<2>()) {
-			case 3: return 6;
-			case 0:
-				switch (r.template get_bits<6>()) {
-				case 3: return 22;
-				case 7: return 23;
-				case 11: return 24;
-				case 15: return 25;
-				case 19: return 26;
-				case 23: return 27;
-				case 27: return 28;
-				case 31: return 29;
-				case 35: return 30;
-				case 39: return 31;
-				case 43: return 32;
-				case 47: return 33;
-				case 51: return 34;
-				case 55: return 35;
-				case 59: return 36;
-				case 63: return 37;
-				case 0: return 262 + 8 * r.template get_bits<5>();
-				case 1: return r.template get_bits<1>() ? 54 : 38;
-				case 2: return 70 + 16 * r.template get_bits<2>();
-				case 4: return 134 + 8 * r.template get_bits<4>();
-				case 5: return r.template get_bits<1>() ? 55 : 39;
-				case 6: return 71 + 16 * r.template get_bits<2>();
-				case 8: return 263 + 8 * r.template get_bits<5>();
-				case 9: return r.template get_bits<1>() ? 56 : 40;
-				case 10: return 72 + 16 * r.template get_bits<2>();
-				case 12: return 135 + 8 * r.template get_bits<4>();
-				case 13: return r.template get_bits<1>() ? 57 : 41;
-				case 14: return 73 + 16 * r.template get_bits<2>();
-				case 16: return 264 + 8 * r.template get_bits<5>();
-				case 17: return r.template get_bits<1>() ? 58 : 42;
-				case 18: return 74 + 16 * r.template get_bits<2>();
-				case 20: return 136 + 8 * r.template get_bits<4>();
-				case 21: return r.template get_bits<1>() ? 59 : 43;
-				case 22: return 75 + 16 * r.template get_bits<2>();
-				case 24: return 265 + 8 * r.template get_bits<5>();
-				case 25: return r.template get_bits<1>() ? 60 : 44;
-				case 26: return 76 + 16 * r.template get_bits<2>();
-				case 28: return 137 + 8 * r.template get_bits<4>();
-				case 29: return r.template get_bits<1>() ? 61 : 45;
-				case 30: return 77 + 16 * r.template get_bits<2>();
-				case 32: return 266 + 8 * r.template get_bits<5>();
-				case 33: return r.template get_bits<1>() ? 62 : 46;
-				case 34: return 78 + 16 * r.template get_bits<2>();
-				case 36: return 138 + 8 * r.template get_bits<4>();
-				case 37: return r.template get_bits<1>() ? 63 : 47;
-				case 38: return 79 + 16 * r.template get_bits<2>();
-				case 40: return 267 + 8 * r.template get_bits<5>();
-				case 41: return r.template get_bits<1>() ? 64 : 48;
-				case 42: return 80 + 16 * r.template get_bits<2>();
-				case 44: return 139 + 8 * r.template get_bits<4>();
-				case 45: return r.template get_bits<1>() ? 65 : 49;
-				case 46: return 81 + 16 * r.template get_bits<2>();
-				case 48: return 268 + 8 * r.template get_bits<5>();
-				case 49: return r.template get_bits<1>() ? 66 : 50;
-				case 50: return 82 + 16 * r.template get_bits<2>();
-				case 52: return 140 + 8 * r.template get_bits<4>();
-				case 53: return r.template get_bits<1>() ? 67 : 51;
-				case 54: return 83 + 16 * r.template get_bits<2>();
-				case 56: return 269 + 8 * r.template get_bits<5>();
-				case 57: return r.template get_bits<1>() ? 68 : 52;
-				case 58: return 84 + 16 * r.template get_bits<2>();
-				case 60: return 141 + 8 * r.template get_bits<4>();
-				case 61: return r.template get_bits<1>() ? 69 : 53;
-				case 62: return 85 + 16 * r.template get_bits<2>();
-				}
-			case 1:
-				switch (r.template get_bits<1>()) {
-				case 1: return 7;
-				case 0: return r.template get_bits<1>() ? 9 : 8;
-				}
-			case 2:
-				switch (r.template get_bits<3>()) {
-				case 1: return 10;
-				case 3: return 11;
-				case 5: return 12;
-				case 7: return 13;
-				case 0: return r.template get_bits<1>() ? 18 : 14;
-				case 2: return r.template get_bits<1>() ? 19 : 15;
-				case 4: return r.template get_bits<1>() ? 20 : 16;
-				case 6: return r.template get_bits<1>() ? 21 : 17;
-				}
-			}
-		case 1: return r.template get_bits<1>() ? 0 : 2;
-		case 2:
-			switch (r.template get_bits<1>()) {
-			case 1: return 3;
-			case 0: return r.template get_bits<1>() ? 4 : 5;
-			}
-		}
-		return -1;
-	};
-
-	auto get_distance = [&]() {
+// The length and distance codes of the PKWARE DCL implode format. These read
+// the code one bit group at a time; decompress only uses them directly for
+// the rare long length codes and otherwise goes through implode_tables.
+template<typename bit_source_T>
+static int implode_get_length(bit_source_T& r) {
+	switch (r.template get_bits<2>()) {
+	case 3: return 1;
+	case 0:
 		switch (r.template get_bits<2>()) {
-		case 3: return 0;
+		case 3: return 6;
 		case 0:
-			switch (r.template get_bits<5>()) {
-			case 1: return 39;
-			case 2: return 47;
-			case 3: return 31;
-			case 5: return 35;
-			case 6: return 43;
-			case 7: return 27;
-			case 9: return 37;
-			case 10: return 45;
-			case 11: return 29;
-			case 13: return 33;
-			case 14: return 41;
+			switch (r.template get_bits<6>()) {
+			case 3: return 22;
+			case 7: return 23;
+			case 11: return 24;
 			case 15: return 25;
-			case 17: return 38;
-			case 18: return 46;
-			case 19: return 30;
-			case 21: return 34;
-			case 22: return 42;
-			case 23: return 26;
-			case 25: return 36;
-			case 26: return 44;
+			case 19: return 26;
+			case 23: return 27;
 			case 27: return 28;
-			case 29: return 32;
-			case 30: return 40;
-			case 31: return 24;
-			case 0: return r.template get_bits<1>() ? 62 : 63;
-			case 4: return r.template get_bits<1>() ? 54 : 55;
-			case 8: return r.template get_bits<1>() ? 58 : 59;
-			case 12: return r.template get_bits<1>() ? 50 : 51;
-			case 16: return r.template get_bits<1>() ? 60 : 61;
-			case 20: return r.template get_bits<1>() ? 52 : 53;
-			case 24: return r.template get_bits<1>() ? 56 : 57;
-			case 28: return r.template get_bits<1>() ? 48 : 49;
+			case 31: return 29;
+			case 35: return 30;
+			case 39: return 31;
+			case 43: return 32;
+			case 47: return 33;
+			case 51: return 34;
+			case 55: return 35;
+			case 59: return 36;
+			case 63: return 37;
+			case 0: return 262 + 8 * r.template get_bits<5>();
+			case 1: return r.template get_bits<1>() ? 54 : 38;
+			case 2: return 70 + 16 * r.template get_bits<2>();
+			case 4: return 134 + 8 * r.template get_bits<4>();
+			case 5: return r.template get_bits<1>() ? 55 : 39;
+			case 6: return 71 + 16 * r.template get_bits<2>();
+			case 8: return 263 + 8 * r.template get_bits<5>();
+			case 9: return r.template get_bits<1>() ? 56 : 40;
+			case 10: return 72 + 16 * r.template get_bits<2>();
+			case 12: return 135 + 8 * r.template get_bits<4>();
+			case 13: return r.template get_bits<1>() ? 57 : 41;
+			case 14: return 73 + 16 * r.template get_bits<2>();
+			case 16: return 264 + 8 * r.template get_bits<5>();
+			case 17: return r.template get_bits<1>() ? 58 : 42;
+			case 18: return 74 + 16 * r.template get_bits<2>();
+			case 20: return 136 + 8 * r.template get_bits<4>();
+			case 21: return r.template get_bits<1>() ? 59 : 43;
+			case 22: return 75 + 16 * r.template get_bits<2>();
+			case 24: return 265 + 8 * r.template get_bits<5>();
+			case 25: return r.template get_bits<1>() ? 60 : 44;
+			case 26: return 76 + 16 * r.template get_bits<2>();
+			case 28: return 137 + 8 * r.template get_bits<4>();
+			case 29: return r.template get_bits<1>() ? 61 : 45;
+			case 30: return 77 + 16 * r.template get_bits<2>();
+			case 32: return 266 + 8 * r.template get_bits<5>();
+			case 33: return r.template get_bits<1>() ? 62 : 46;
+			case 34: return 78 + 16 * r.template get_bits<2>();
+			case 36: return 138 + 8 * r.template get_bits<4>();
+			case 37: return r.template get_bits<1>() ? 63 : 47;
+			case 38: return 79 + 16 * r.template get_bits<2>();
+			case 40: return 267 + 8 * r.template get_bits<5>();
+			case 41: return r.template get_bits<1>() ? 64 : 48;
+			case 42: return 80 + 16 * r.template get_bits<2>();
+			case 44: return 139 + 8 * r.template get_bits<4>();
+			case 45: return r.template get_bits<1>() ? 65 : 49;
+			case 46: return 81 + 16 * r.template get_bits<2>();
+			case 48: return 268 + 8 * r.template get_bits<5>();
+			case 49: return r.template get_bits<1>() ? 66 : 50;
+			case 50: return 82 + 16 * r.template get_bits<2>();
+			case 52: return 140 + 8 * r.template get_bits<4>();
+			case 53: return r.template get_bits<1>() ? 67 : 51;
+			case 54: return 83 + 16 * r.template get_bits<2>();
+			case 56: return 269 + 8 * r.template get_bits<5>();
+			case 57: return r.template get_bits<1>() ? 68 : 52;
+			case 58: return 84 + 16 * r.template get_bits<2>();
+			case 60: return 141 + 8 * r.template get_bits<4>();
+			case 61: return r.template get_bits<1>() ? 69 : 53;
+			case 62: return 85 + 16 * r.template get_bits<2>();
 			}
 		case 1:
-			switch (r.template get_bits<2>()) {
-			case 1: return 2;
-			case 3: return 1;
-			case 0: return r.template get_bits<1>() ? 5 : 6;
-			case 2: return r.template get_bits<1>() ? 3 : 4;
+			switch (r.template get_bits<1>()) {
+			case 1: return 7;
+			case 0: return r.template get_bits<1>() ? 9 : 8;
 			}
 		case 2:
-			switch (r.template get_bits<4>()) {
-			case 1: return 14;
-			case 2: return 18;
-			case 3: return 10;
-			case 4: return 20;
+			switch (r.template get_bits<3>()) {
+			case 1: return 10;
+			case 3: return 11;
 			case 5: return 12;
-			case 6: return 16;
-			case 7: return 8;
-			case 8: return 21;
-			case 9: return 13;
-			case 10: return 17;
-			case 11: return 9;
-			case 12: return 19;
-			case 13: return 11;
-			case 14: return 15;
-			case 15: return 7;
-			case 0: return r.template get_bits<1>() ? 22 : 23;
+			case 7: return 13;
+			case 0: return r.template get_bits<1>() ? 18 : 14;
+			case 2: return r.template get_bits<1>() ? 19 : 15;
+			case 4: return r.template get_bits<1>() ? 20 : 16;
+			case 6: return r.template get_bits<1>() ? 21 : 17;
 			}
 		}
-		return -1;
+	case 1: return r.template get_bits<1>() ? 0 : 2;
+	case 2:
+		switch (r.template get_bits<1>()) {
+		case 1: return 3;
+		case 0: return r.template get_bits<1>() ? 4 : 5;
+		}
+	}
+	return -1;
+}
+
+template<typename bit_source_T>
+static int implode_get_distance(bit_source_T& r) {
+	switch (r.template get_bits<2>()) {
+	case 3: return 0;
+	case 0:
+		switch (r.template get_bits<5>()) {
+		case 1: return 39;
+		case 2: return 47;
+		case 3: return 31;
+		case 5: return 35;
+		case 6: return 43;
+		case 7: return 27;
+		case 9: return 37;
+		case 10: return 45;
+		case 11: return 29;
+		case 13: return 33;
+		case 14: return 41;
+		case 15: return 25;
+		case 17: return 38;
+		case 18: return 46;
+		case 19: return 30;
+		case 21: return 34;
+		case 22: return 42;
+		case 23: return 26;
+		case 25: return 36;
+		case 26: return 44;
+		case 27: return 28;
+		case 29: return 32;
+		case 30: return 40;
+		case 31: return 24;
+		case 0: return r.template get_bits<1>() ? 62 : 63;
+		case 4: return r.template get_bits<1>() ? 54 : 55;
+		case 8: return r.template get_bits<1>() ? 58 : 59;
+		case 12: return r.template get_bits<1>() ? 50 : 51;
+		case 16: return r.template get_bits<1>() ? 60 : 61;
+		case 20: return r.template get_bits<1>() ? 52 : 53;
+		case 24: return r.template get_bits<1>() ? 56 : 57;
+		case 28: return r.template get_bits<1>() ? 48 : 49;
+		}
+	case 1:
+		switch (r.template get_bits<2>()) {
+		case 1: return 2;
+		case 3: return 1;
+		case 0: return r.template get_bits<1>() ? 5 : 6;
+		case 2: return r.template get_bits<1>() ? 3 : 4;
+		}
+	case 2:
+		switch (r.template get_bits<4>()) {
+		case 1: return 14;
+		case 2: return 18;
+		case 3: return 10;
+		case 4: return 20;
+		case 5: return 12;
+		case 6: return 16;
+		case 7: return 8;
+		case 8: return 21;
+		case 9: return 13;
+		case 10: return 17;
+		case 11: return 9;
+		case 12: return 19;
+		case 13: return 11;
+		case 14: return 15;
+		case 15: return 7;
+		case 0: return r.template get_bits<1>() ? 22 : 23;
+		}
+	}
+	return -1;
+}
+
+// Decode tables for the length and distance codes, indexed by the next 8 bits
+// of input. Each entry holds the decoded value and the number of bits it
+// consumes, including any extra bits, or 0 bits if the code is longer than
+// the table and has to be decoded bit by bit.
+struct implode_tables {
+	struct entry {
+		uint16_t value;
+		uint8_t bits;
+	};
+	static const size_t lookup_bits = 8;
+	std::array<entry, 1 << lookup_bits> length;
+	std::array<entry, 1 << lookup_bits> distance;
+
+	struct table_bit_source {
+		size_t value;
+		size_t pos = 0;
+		bool overflow = false;
+		template<size_t bits>
+		size_t get_bits() {
+			if (pos + bits > lookup_bits) {
+				overflow = true;
+				return 0;
+			}
+			size_t r = (value >> pos) & (((size_t)1 << bits) - 1);
+			pos += bits;
+			return r;
+		}
 	};
 
+	template<typename F>
+	static void build(std::array<entry, 1 << lookup_bits>& table, F&& f) {
+		for (size_t i = 0; i != table.size(); ++i) {
+			table_bit_source src{i};
+			int value = f(src);
+			if (src.overflow) table[i] = {0, 0};
+			else table[i] = {(uint16_t)value, (uint8_t)src.pos};
+		}
+	}
+
+	implode_tables() {
+		build(length, [](table_bit_source& src) {
+			return implode_get_length(src);
+		});
+		build(distance, [](table_bit_source& src) {
+			return implode_get_distance(src);
+		});
+	}
+
+	static const implode_tables& get() {
+		static const implode_tables tables;
+		return tables;
+	}
+};
+
+// Reads the little endian bit stream of imploded data. bits holds up to 64
+// bits of input and is topped up once per token, which is never longer than
+// 30 bits, so peeking at a token needs no bounds checks.
+struct implode_bit_reader {
+	const uint8_t* in;
+	const uint8_t* in_end;
+	uint64_t bits = 0;
+	size_t bits_n = 0;
+	implode_bit_reader(const uint8_t* begin, const uint8_t* end) : in(begin), in_end(end) {}
+	void refill() {
+		while (bits_n <= 56 && in != in_end) {
+			bits |= (uint64_t)*in++ << bits_n;
+			bits_n += 8;
+		}
+	}
+	size_t peek(size_t n) const {
+		return (size_t)(bits & (((uint64_t)1 << n) - 1));
+	}
+	void consume(size_t n) {
+		if (n > bits_n) error("decompress: attempt to read past end");
+		bits >>= n;
+		bits_n -= n;
+	}
+	size_t get(size_t n) {
+		size_t r = peek(n);
+		consume(n);
+		return r;
+	}
+	template<size_t n>
+	size_t get_bits() {
+		return get(n);
+	}
+};
+
+template<bool little_endian = true>
+void decompress(uint8_t* input, size_t input_size, uint8_t* output, size_t output_size) {
+	const implode_tables& tables = implode_tables::get();
+
+	implode_bit_reader r(input, input + input_size);
+
+	r.refill();
+	int type = (int)r.get(8);
+	int distance_bits = (int)r.get(8);
+
+	if (distance_bits != 4 && distance_bits != 5 && distance_bits != 6) error("decompress: invalid distance bits %d", distance_bits);
 
 	size_t out_pos = 0;
 
 	if (type == 0) {
 
 		while (out_pos != output_size) {
-			if (r.template get_bits<1>()) {
+			r.refill();
+			if (r.get(1)) {
 
-				size_t len = 2 + get_length();
-				size_t distance = 0;
+				auto& le = tables.length[r.peek(implode_tables::lookup_bits)];
+				size_t len;
+				if (le.bits) {
+					r.consume(le.bits);
+					len = 2 + le.value;
+				} else len = 2 + implode_get_length(r);
 
 				if (len == 519) error("decompress: eof marker found too early");
 
-				if (len == 2) {
-					distance = get_distance() << 2;
-					distance |= r.template get_bits<2>();
-				} else {
-					distance = get_distance() << distance_bits;
-					if (distance_bits == 4) distance |= r.template get_bits<4>();
-					else if (distance_bits == 5) distance |= r.template get_bits<5>();
-					else distance |= r.template get_bits<6>();
-				}
-				size_t src_pos = out_pos - 1 - distance;
-				if (src_pos > output_size) {
-					len = 0;
-				}
-				if (src_pos + len > output_size) {
-					len = output_size - src_pos;
-				}
+				auto& de = tables.distance[r.peek(implode_tables::lookup_bits)];
+				r.consume(de.bits);
+				size_t distance = de.value;
+				if (len == 2) distance = distance << 2 | r.get(2);
+				else distance = distance << distance_bits | r.get(distance_bits);
+
+				// A match reaching back before the start of the output is
+				// ignored.
+				if (distance >= out_pos) len = 0;
 				if (out_pos + len > output_size) {
 					len = output_size - out_pos;
 				}
-				for (size_t i = 0; i != len; ++i) {
-					output[out_pos + i] = output[src_pos + i];
+				if (len) {
+					uint8_t* dst = output + out_pos;
+					const uint8_t* src = dst - 1 - distance;
+					size_t gap = distance + 1;
+					if (gap >= len) {
+						memcpy(dst, src, len);
+					} else if (gap >= 8) {
+						// Overlapping, but every 8 byte chunk only reads bytes
+						// that have already been written.
+						size_t i = 0;
+						for (; i + 8 <= len; i += 8) memcpy(dst + i, src + i, 8);
+						for (; i != len; ++i) dst[i] = src[i];
+					} else if (gap == 1) {
+						memset(dst, *src, len);
+					} else {
+						for (size_t i = 0; i != len; ++i) dst[i] = src[i];
+					}
 				}
 				out_pos += len;
 
 			} else {
-				output[out_pos] = r.template get<uint8_t>();
+				output[out_pos] = (uint8_t)r.get(8);
 				++out_pos;
 			}
 		}
@@ -1071,12 +1299,20 @@ struct mpq_archive_file_reader {
 			read_sectors(r);
 		}
 	}
-	void read_sector() {
-		current_sector = file_position / sector_size;
-		if (current_sector >= compressed_sectors.size() - 1) error("mpq: %s: attempt to read past end", filename);
 
-		size_t sector_data_size = compressed_sectors[current_sector + 1] - compressed_sectors[current_sector];
-		r.seek(be.data_offset + compressed_sectors[current_sector]);
+	size_t sector_output_size(size_t sector) const {
+		return std::min(sector_size, be.size - sector * sector_size);
+	}
+
+	// Decodes a sector from sector_r, which must be positioned at its start,
+	// into sector_data. compressed_data and sector_data are scratch buffers
+	// that may be swapped between decompression stages; sector_data is at
+	// least sector_size bytes afterwards. Returns the decoded size.
+	template<typename sector_reader_T>
+	size_t decode_sector(sector_reader_T& sector_r, size_t sector, a_vector<uint8_t>& compressed_data, a_vector<uint8_t>& sector_data) const {
+		size_t sector_data_size = compressed_sectors[sector + 1] - compressed_sectors[sector];
+		size_t current_sector_size = sector_output_size(sector);
+		if (sector_data.size() < sector_size) sector_data.resize(sector_size);
 
 		int compression_flags;
 		auto get_data = [&](auto&& sector_data_r) {
@@ -1092,15 +1328,12 @@ struct mpq_archive_file_reader {
 			}
 		};
 
-		size_t current_sector_size = sector_data.size();
-		if (current_sector == compressed_sectors.size() - 2) current_sector_size = be.size % sector_size;
-
 		if (sector_data_size == current_sector_size && sector_data_size <= sector_size) {
-			if (be.flags & 0x10000) make_encrypted_reader(r, sector_data_size, key + (uint32_t)current_sector, crypt_table).get_bytes(sector_data.data(), sector_data_size);
-			else r.get_bytes(sector_data.data(), sector_data_size);
+			if (be.flags & 0x10000) make_encrypted_reader(sector_r, sector_data_size, key + (uint32_t)sector, crypt_table).get_bytes(sector_data.data(), sector_data_size);
+			else sector_r.get_bytes(sector_data.data(), sector_data_size);
 		} else {
-			if (be.flags & 0x10000) get_data(make_encrypted_reader(r, sector_data_size, key + (uint32_t)current_sector, crypt_table));
-			else get_data(r);
+			if (be.flags & 0x10000) get_data(make_encrypted_reader(sector_r, sector_data_size, key + (uint32_t)sector, crypt_table));
+			else get_data(sector_r);
 			if (compression_flags == 8) decompress(compressed_data.data(), sector_data_size, sector_data.data(), current_sector_size);
 			else {
 				size_t input_size = sector_data_size;
@@ -1108,7 +1341,7 @@ struct mpq_archive_file_reader {
 					input_size = new_input_size;
 					std::swap(compressed_data, sector_data);
 					if (compressed_data.size() < sector_data_size) compressed_data.resize(sector_data_size);
-					if (sector_data.size() < current_sector_size) sector_data.resize(current_sector_size);
+					if (sector_data.size() < sector_size) sector_data.resize(sector_size);
 				};
 				if (compression_flags & 1) {
 					compression_flags &= ~1;
@@ -1128,7 +1361,67 @@ struct mpq_archive_file_reader {
 				if (compression_flags != 0) error("mpq: %s: unsupported compression flags %d", filename, compression_flags);
 			}
 		}
+		return current_sector_size;
+	}
+
+	void read_sector() {
+		current_sector = file_position / sector_size;
+		if (current_sector >= compressed_sectors.size() - 1) error("mpq: %s: attempt to read past end", filename);
 
+		r.seek(be.data_offset + compressed_sectors[current_sector]);
+		decode_sector(r, current_sector, compressed_data, sector_data);
+	}
+
+	// Reads the whole file into dst, which must hold size() bytes. The
+	// compressed data is read in one go and the sectors are then decoded
+	// independently, spread over up to max_threads threads.
+	void read_all(uint8_t* dst, size_t max_threads = 1) {
+		size_t sectors = compressed_sectors.size() - 1;
+		if (sectors * sector_size < be.size) error("mpq: %s: not enough sectors", filename);
+		for (size_t i = 0; i != sectors; ++i) {
+			if (compressed_sectors[i + 1] < compressed_sectors[i]) error("mpq: %s: invalid sector offsets", filename);
+		}
+		size_t begin_offset = compressed_sectors.front();
+		a_vector<uint8_t> raw(compressed_sectors.back() - begin_offset);
+		r.seek(be.data_offset + begin_offset);
+		if (!raw.empty()) r.get_bytes(raw.data(), raw.size());
+
+		auto decode_range = [&](size_t begin, size_t end) {
+			a_vector<uint8_t> compressed_data;
+			a_vector<uint8_t> sector_data;
+			for (size_t i = begin; i != end; ++i) {
+				const uint8_t* p = raw.data() + (compressed_sectors[i] - begin_offset);
+				data_reader<default_little_endian> sector_r(p, p + (compressed_sectors[i + 1] - compressed_sectors[i]));
+				size_t n = decode_sector(sector_r, i, compressed_data, sector_data);
+				memcpy(dst + i * sector_size, sector_data.data(), n);
+			}
+		};
+
+		// Small files are not worth starting threads for.
+		size_t threads = std::min(max_threads, sectors / 8);
+#ifndef EMSCRIPTEN
+		if (threads > 1) {
+			a_vector<std::thread> workers;
+			a_vector<std::exception_ptr> exceptions(threads);
+			for (size_t t = 0; t != threads; ++t) {
+				workers.emplace_back([&, t]() {
+					try {
+						decode_range(sectors * t / threads, sectors * (t + 1) / threads);
+					} catch (...) {
+						exceptions[t] = std::current_exception();
+					}
+				});
+			}
+			for (auto& v : workers) v.join();
+			for (auto& v : exceptions) {
+				if (v) std::rethrow_exception(v);
+			}
+		} else decode_range(0, sectors);
+#else
+		(void)threads;
+		decode_range(0, sectors);
+#endif
+		file_position = be.size;
 	}
 
 	void get_bytes(uint8_t* dst, size_t n) {
@@ -1168,6 +1461,9 @@ struct mpq_archive_reader {
 	size_t sector_size;
 	a_vector<hash_table_entry> hash_table;
 	a_vector<block_table_entry> block_table;
+	// Maximum number of threads used to decode the sectors of a file read
+	// with read_file.
+	size_t decode_threads = 1;
 	explicit mpq_archive_reader(base_reader_T& r) : r(r) {
 		auto mpq_signature = r.template get<uint32_t>();
 		if (mpq_signature != 0x1a51504d) error("signature mismatch; file is not an mpq archive");
@@ -1213,10 +1509,26 @@ struct mpq_archive_reader {
 		}
 	}
 
+	struct filename_hashes {
+		uint32_t hash0;
+		uint32_t hash1;
+		uint32_t hash2;
+	};
+
+	// The hashes only depend on the filename, so they can be computed once
+	// and looked up in several archives.
+	filename_hashes hash_filename(const a_string& filename) const {
+		return {string_hash(filename.c_str(), 0, crypt_table), string_hash(filename.c_str(), 1, crypt_table), string_hash(filename.c_str(), 2, crypt_table)};
+	}
+
 	const hash_table_entry* find_hash_table_entry(const a_string& filename) const {
-		auto hash0 = string_hash(filename.c_str(), 0, crypt_table);
-		auto hash1 = string_hash(filename.c_str(), 1, crypt_table);
-		auto hash2 = string_hash(filename.c_str(), 2, crypt_table);
+		return find_hash_table_entry(hash_filename(filename));
+	}
+
+	const hash_table_entry* find_hash_table_entry(const filename_hashes& hashes) const {
+		uint32_t hash0 = hashes.hash0;
+		uint32_t hash1 = hashes.hash1;
+		uint32_t hash2 = hashes.hash2;
 
 		bool found = false;
 		size_t initial_index = hash0 % hash_table.size();
@@ -1243,7 +1555,10 @@ struct mpq_archive_reader {
 	auto open(a_string filename) {
 		auto* he = find_hash_table_entry(filename);
 		if (!he) error("mpq: %s: no such file", filename);
+		return open(std::move(filename), he);
+	}
 
+	auto open(a_string filename, const hash_table_entry* he) {
 		const char* c = filename.data() + filename.size();
 		while (c != filename.data()) {
 			auto pc = *(c - 1);
@@ -1261,6 +1576,12 @@ struct mpq_archive_reader {
 		return mpq_archive_file_reader<base_reader_T, default_little_endian>(std::move(filename), r, sector_size, be, file_key, crypt_table);
 	}
 
+	void read_file(a_vector<uint8_t>& dst, a_string filename, const hash_table_entry* he = nullptr) {
+		auto file_r = he ? open(std::move(filename), he) : open(std::move(filename));
+		dst.resize(file_r.size());
+		file_r.read_all(dst.data(), decode_threads);
+	}
+
 };
 
 template<typename base_reader_T>
@@ -1273,11 +1594,7 @@ struct mpq_data {
 	mpq_archive_reader<data_reader<>> mpq;
 	explicit mpq_data(uint8_t* data, size_t data_size) : r(data, data + data_size), mpq(r) {}
 	void operator()(a_vector<uint8_t>& dst, a_string filename) {
-		auto file_r = mpq.open(std::move(filename));
-		size_t len = file_r.size();
-		dst.resize(len);
-		file_r.get_bytes(dst.data(), len);
-		return;
+		mpq.read_file(dst, std::move(filename));
 	}
 };
 
@@ -1288,11 +1605,7 @@ struct mpq_file {
 	mpq_archive_reader<paged_reader<file_reader_T>> mpq;
 	explicit mpq_file(a_string filename) : file(std::move(filename)), paged(file), mpq(paged) {}
 	void operator()(a_vector<uint8_t>& dst, a_string filename) {
-		auto file_r = mpq.open(std::move(filename));
-		size_t len = file_r.size();
-		dst.resize(len);
-		file_r.get_bytes(dst.data(), len);
-		return;
+		mpq.read_file(dst, std::move(filename));
 	}
 };
 
@@ -1304,28 +1617,227 @@ struct data_files_loader {
 		mpqs.emplace_back(std::move(filename));
 	}
 
+	void set_decode_threads(size_t threads) {
+		for (auto& v : mpqs) v.mpq.decode_threads = threads;
+	}
+
 	void operator()(a_vector<uint8_t>& dst, a_string filename) {
-		for (auto& v : mpqs) {
-			if (v.mpq.file_exists(filename)) {
-				v(dst, std::move(filename));
-				return;
+		if (!mpqs.empty()) {
+			// All archives use the same crypt table, so the filename only
+			// needs to be hashed once.
+			auto hashes = mpqs.front().mpq.hash_filename(filename);
+			for (auto& v : mpqs) {
+				if (auto* he = v.mpq.find_hash_table_entry(hashes)) {
+					v.mpq.read_file(dst, std::move(filename), he);
+					return;
+				}
 			}
 		}
 		error("data_files_loader: %s: file not found", filename);
 	}
 };
 
+static const std::array<const char*, 3> data_files_mpq_names = {"Patch_rt.mpq", "BrooDat.mpq", "StarDat.mpq"};
+
 template<typename data_files_loader_T = data_files_loader<>>
 data_files_loader_T data_files_directory(a_string path) {
 	if (!path.empty() && path[path.size() - 1] != '/' && path[path.size() - 1] != '\\') path += '/';
 	data_files_loader_T r;
-	r.add_mpq_file(path + "Patch_rt.mpq");
-	r.add_mpq_file(path + "BrooDat.mpq");
-	r.add_mpq_file(path + "StarDat.mpq");
+	for (const char* name : data_files_mpq_names) {
+		r.add_mpq_file(path + name);
+	}
 
 	return r;
 }
 
+// A persistent cache of decompressed data files, used in place of
+// data_files_directory. Files that are in the memory mapped cache file are
+// copied out of it, without opening or decompressing the mpq archives, and
+// anything else is loaded from the archives. save() then writes every file
+// that was requested back to the cache file, so a second run of the same
+// program finds everything there. This only saves the decompression; each
+// process still gets its own copy of every file it requests.
+//
+// The cache is keyed on the size and modification time of the archives. The
+// key and index carry a crc that is checked when the cache is opened, and
+// each file has its own crc that is only checked when that file is
+// requested, so files that are never requested are never read. A cache with
+// a bad key or index is ignored, and a file with a bad crc is loaded from
+// the archives instead; either way save() rewrites the cache.
+//
+// Layout, all little endian:
+//   u32 magic, u32 version, u32 crc32 of the key and index
+//   u32 key size, key
+//   u32 entry count, then per entry: u32 name size, name, u32 offset,
+//   u32 size, u32 crc32
+//   file contents
+template<typename data_files_loader_T = data_files_loader<>>
+struct data_files_cache {
+	static const uint32_t magic = 0x43574230; // "0BWC"
+	static const uint32_t version = 2;
+
+	a_string path;
+	a_string cache_filename;
+	a_string key;
+	mapped_file file;
+	struct cached_file {
+		size_t offset;
+		size_t size;
+		uint32_t crc;
+	};
+	a_map<a_string, cached_file> cached_files;
+	crc32_t crc32;
+	a_map<a_string, a_vector<uint8_t>> loaded_files;
+	std::unique_ptr<data_files_loader_T> loader;
+	size_t decode_threads = 1;
+
+	data_files_cache(a_string arg_path, a_string arg_cache_filename) : path(std::move(arg_path)), cache_filename(std::move(arg_cache_filename)) {
+		if (!path.empty() && path[path.size() - 1] != '/' && path[path.size() - 1] != '\\') path += '/';
+		for (const char* name : data_files_mpq_names) {
+			key += name;
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(EMSCRIPTEN)
+			struct stat s;
+			if (stat((path + name).c_str(), &s) == 0) key += format(":%lld:%lld;", (long long)s.st_size, (long long)s.st_mtime);
+			else key += ":-;";
+#else
+			try {
+				key += format(":%lld;", (long long)file_reader<>(path + name).size());
+			} catch (const exception&) {
+				key += ":-;";
+			}
+#endif
+		}
+		try {
+			file.open(cache_filename);
+		} catch (const exception&) {
+			return;
+		}
+		if (!read_index()) {
+			cached_files.clear();
+			file.close();
+		}
+	}
+
+	bool read_index() {
+		try {
+			data_reader_le r(file.data(), file.data() + file.size());
+			if (r.get<uint32_t>() != magic) return false;
+			if (r.get<uint32_t>() != version) return false;
+			uint32_t crc = r.get<uint32_t>();
+			const uint8_t* index_begin = r.ptr;
+			size_t key_size = r.get<uint32_t>();
+			if (a_string((const char*)r.get_n(key_size), key_size) != key) return false;
+			size_t entries = r.get<uint32_t>();
+			for (size_t i = 0; i != entries; ++i) {
+				size_t name_size = r.get<uint32_t>();
+				a_string name((const char*)r.get_n(name_size), name_size);
+				size_t offset = r.get<uint32_t>();
+				size_t size = r.get<uint32_t>();
+				uint32_t file_crc = r.get<uint32_t>();
+				if (offset > file.size() || file.size() - offset < size) return false;
+				cached_files[std::move(name)] = {offset, size, file_crc};
+			}
+			if (crc32(index_begin, r.ptr - index_begin) != crc) return false;
+		} catch (const exception&) {
+			return false;
+		}
+		return true;
+	}
+
+	void operator()(a_vector<uint8_t>& dst, a_string filename) {
+		auto i = cached_files.find(filename);
+		if (i != cached_files.end()) {
+			const uint8_t* data = file.data() + i->second.offset;
+			if (crc32(data, i->second.size) == i->second.crc) {
+				dst.assign(data, data + i->second.size);
+				return;
+			}
+			cached_files.erase(i);
+		}
+		if (!loader) {
+			loader = std::make_unique<data_files_loader_T>(data_files_directory<data_files_loader_T>(path));
+			loader->set_decode_threads(decode_threads);
+		}
+		(*loader)(dst, filename);
+		loaded_files[std::move(filename)] = dst;
+	}
+
+	// Writes the cache file if any file had to be loaded from the archives.
+	// The new file is written next to the old one and renamed over it, so
+	// other processes never see a partially written cache.
+	void save() {
+		if (loaded_files.empty()) return;
+
+		struct entry {
+			const a_string* name;
+			const uint8_t* data;
+			size_t size;
+			uint32_t crc;
+		};
+		a_vector<entry> entries;
+		// Entries that were not requested are carried over with their old
+		// crc, unverified, so they are still checked when next requested.
+		for (auto& v : cached_files) {
+			if (loaded_files.count(v.first)) continue;
+			entries.push_back({&v.first, file.data() + v.second.offset, v.second.size, v.second.crc});
+		}
+		for (auto& v : loaded_files) {
+			entries.push_back({&v.first, v.second.data(), v.second.size(), crc32(v.second.data(), v.second.size())});
+		}
+
+		a_vector<uint8_t> header;
+		auto put32 = [&](size_t v) {
+			if ((uint32_t)v != v) error("data_files_cache: %s: value %d too large", cache_filename, v);
+			header.resize(header.size() + 4);
+			set_value_at<true, uint32_t>(header.data() + header.size() - 4, (uint32_t)v);
+		};
+		auto put_string = [&](const a_string& str) {
+			put32(str.size());
+			header.insert(header.end(), str.begin(), str.end());
+		};
+		put32(magic);
+		put32(version);
+		put32(0);
+		put_string(key);
+		put32(entries.size());
+		size_t header_size = header.size();
+		for (auto& v : entries) header_size += 4 + v.name->size() + 12;
+		size_t offset = header_size;
+		for (auto& v : entries) {
+			put_string(*v.name);
+			put32(offset);
+			put32(v.size);
+			put32(v.crc);
+			offset += v.size;
+		}
+		set_value_at<true, uint32_t>(header.data() + 8, crc32(header.data() + 12, header.size() - 12));
+
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(EMSCRIPTEN)
+		a_string tmp_filename = format("%s.%d.tmp", cache_filename, (int)getpid());
+#else
+		a_string tmp_filename = cache_filename + ".tmp";
+#endif
+		FILE* f = fopen(tmp_filename.c_str(), "wb");
+		if (!f) error("data_files_cache: failed to open %s for writing", tmp_filename);
+		bool ok = fwrite(header.data(), header.size(), 1, f) == 1;
+		for (auto& v : entries) {
+			if (ok && v.size) ok = fwrite(v.data, v.size, 1, f) == 1;
+		}
+		if (fclose(f) != 0) ok = false;
+		if (!ok) {
+			std::remove(tmp_filename.c_str());
+			error("data_files_cache: %s: write error", tmp_filename);
+		}
+#if !(defined(__unix__) || defined(__APPLE__))
+		std::remove(cache_filename.c_str());
+#endif
+		if (std::rename(tmp_filename.c_str(), cache_filename.c_str()) != 0) {
+			std::remove(tmp_filename.c_str());
+			error("data_files_cache: failed to rename %s to %s", tmp_filename, cache_filename);
+		}
+	}
+};
+
 template<typename to_T, typename from_T>
 struct data_type_cast_helper {
 	to_T operator()(from_T v) {
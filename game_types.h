@@ -16,7 +16,7 @@ namespace bwgame
 	struct unit_id_t
 	{
 		T raw_value = 0;
-		static size_t unit_generation_size;
+		static thread_local size_t unit_generation_size;
 
 		unit_id_t() = default;
 		explicit unit_id_t(T raw_value) : raw_value(raw_value) {}
@@ -36,7 +36,7 @@ namespace bwgame
 	};
 
 	template <typename T>
-	size_t unit_id_t<T>::unit_generation_size = 5;
+	thread_local size_t unit_id_t<T>::unit_generation_size = 5;
 
 	using unit_id = unit_id_t<uint16_t>;
 	using unit_id_32 = unit_id_t<uint32_t>;
@@ -122,11 +122,15 @@ namespace bwgame
 		{
 			if (size == max_size)
 				error("object_container: attempt to grow beyond max_size");
-			list.emplace_back();
+			// Chunks past size can be left over from restoring a state_snapshot;
+			// they are reused so that objects never change address.
+			if (list.size() * allocation_granularity <= size)
+				list.emplace_back();
+			auto &chunk = list[size / allocation_granularity];
 			size_t n = std::min(allocation_granularity, max_size - size);
 			for (size_t i = 0; i != n; ++i)
 			{
-				T *obj = &list.back()[i];
+				T *obj = &chunk[i];
 				obj->index = size == 0 ? 0 : max_size - size;
 				if (add_new_to_free)
 					free_list.push_back(*obj);
@@ -1006,7 +1006,7 @@ struct full_state {
 };
 
 struct saved_state {
-	bwgame::state st;
+	bwgame::state_snapshot snapshot;
 	bwgame::optional<bwgame::action_state> action_st;
 	game_vars vars;
 };
@@ -1051,6 +1051,10 @@ struct Game_impl {
 	void load_map() {
 		auto& filename = set_map_filename;
 
+		// Snapshots are restored into the objects of the game they were
+		// taken from, which are about to be replaced.
+		snapshots.clear();
+
 		fst.game_st = bwgame::game_state();
 		st = bwgame::state();
 		st.global = &fst.global_st;
@@ -1219,8 +1223,8 @@ struct Game_impl {
 	
 	void save_snapshot(std::string id) {
 		auto v = std::make_unique<saved_state>();
-		v->st = bwgame::copy_state(st);
-		if (vars.is_replay) v->action_st = bwgame::copy_state(action_st, st, v->st);
+		v->snapshot.save(st);
+		if (vars.is_replay) v->action_st = bwgame::copy_state(action_st, st, st);
 		v->vars = vars;
 		snapshots[std::move(id)] = std::move(v);
 	}
@@ -1229,8 +1233,8 @@ struct Game_impl {
 		if (i == snapshots.end()) error("no such snapshot: '%s'", id);
 		auto& v = i->second;
 		vars = v->vars;
-		st = bwgame::copy_state(v->st);
-		if (vars.is_replay) action_st = bwgame::copy_state(*v->action_st, v->st, st);
+		v->snapshot.restore(st);
+		if (vars.is_replay) action_st = bwgame::copy_state(*v->action_st, st, st);
 		
 		funcs.reset_bwapi();
 	}
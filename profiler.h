@@ -0,0 +1,284 @@
+#ifndef BWGAME_PROFILER_H
+#define BWGAME_PROFILER_H
+
+// Frame profiler for the simulation. Everything here is compiled out unless
+// OPENBW_ENABLE_PROFILER is defined, in which case the OPENBW_PROFILE_* macros
+// used in bwgame.h time their enclosing scope and report it to the
+// frame_profiler installed on the current thread (if any).
+//
+//	bwgame::profiler::frame_profiler prof;
+//	bwgame::profiler::install(&prof);
+//	... run frames ...
+//	prof.print_summary(stdout);
+//	prof.write_chrome_trace("trace.json");
+
+#ifdef OPENBW_ENABLE_PROFILER
+
+#include "util.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+
+namespace bwgame {
+namespace profiler {
+
+enum zone_id {
+	zone_frame,
+	zone_recede_creep,
+	zone_update_units,
+	zone_update_units_movement,
+	zone_update_units_sprite,
+	zone_update_units_unit,
+	zone_update_units_hidden,
+	zone_update_units_cloaked,
+	zone_update_bullets,
+	zone_update_thingies,
+	zone_process_triggers,
+	zone_pathfinder_find,
+	zone_iscript_execute,
+	zone_unit_finder_insert,
+	zone_unit_finder_remove,
+	zone_unit_finder_reinsert,
+	zone_unit_finder_search_setup,
+	zone_unit_collision,
+	zone_count
+};
+
+static const std::array<const char*, zone_count> zone_names = {
+	"frame",
+	"recede_creep",
+	"update_units",
+	"update_units.movement",
+	"update_units.sprite",
+	"update_units.unit",
+	"update_units.hidden",
+	"update_units.cloaked",
+	"update_bullets",
+	"update_thingies",
+	"process_triggers",
+	"pathfinder_find",
+	"iscript_execute",
+	"unit_finder_insert",
+	"unit_finder_remove",
+	"unit_finder_reinsert",
+	"unit_finder_search_setup",
+	"unit_collision",
+};
+
+// Zones that run once or a handful of times per frame are recorded as
+// individual trace slices; the rest are far too frequent for that and are
+// only emitted as per-frame counters.
+static inline bool zone_is_sliced(zone_id zone) {
+	return zone <= zone_process_triggers;
+}
+
+using profile_clock = std::chrono::steady_clock;
+
+struct frame_profiler {
+	// Per-frame time histogram, bucket n holds frames that spent
+	// [2^(n-1), 2^n) microseconds in the zone (bucket 0 is < 1us).
+	static const size_t histogram_size = 24;
+
+	struct zone_stats {
+		uint64_t calls = 0;
+		uint64_t total_ns = 0;
+		uint64_t max_frame_ns = 0;
+		std::array<uint64_t, histogram_size> histogram{};
+
+		uint64_t frame_calls = 0;
+		uint64_t frame_ns = 0;
+		int depth = 0;
+	};
+
+	struct slice {
+		zone_id zone;
+		int frame;
+		uint64_t begin_ns;
+		uint64_t duration_ns;
+	};
+
+	struct counter {
+		int frame;
+		uint64_t ts_ns;
+		std::array<uint32_t, zone_count> calls;
+		std::array<uint32_t, zone_count> ns;
+	};
+
+	std::array<zone_stats, zone_count> zones;
+	a_vector<slice> slices;
+	a_vector<counter> counters;
+	bool record_trace = true;
+	profile_clock::time_point epoch = profile_clock::now();
+	int current_frame = 0;
+	int frames = 0;
+
+	uint64_t now_ns() const {
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(profile_clock::now() - epoch).count();
+	}
+
+	void reset() {
+		zones = {};
+		slices.clear();
+		counters.clear();
+		epoch = profile_clock::now();
+		frames = 0;
+	}
+
+	void begin_frame(int frame) {
+		current_frame = frame;
+	}
+
+	void end_frame() {
+		++frames;
+		counter c;
+		c.frame = current_frame;
+		c.ts_ns = now_ns();
+		for (size_t i = 0; i != zone_count; ++i) {
+			auto& z = zones[i];
+			z.calls += z.frame_calls;
+			z.total_ns += z.frame_ns;
+			if (z.frame_ns > z.max_frame_ns) z.max_frame_ns = z.frame_ns;
+			if (z.frame_calls) {
+				size_t bucket = 0;
+				for (uint64_t us = z.frame_ns / 1000; us && bucket != histogram_size - 1; us >>= 1) ++bucket;
+				++z.histogram[bucket];
+			}
+			c.calls[i] = (uint32_t)z.frame_calls;
+			c.ns[i] = (uint32_t)std::min(z.frame_ns, (uint64_t)0xffffffff);
+			z.frame_calls = 0;
+			z.frame_ns = 0;
+		}
+		if (record_trace) counters.push_back(c);
+	}
+
+	void add(zone_id zone, uint64_t begin_ns, uint64_t end_ns) {
+		auto& z = zones[zone];
+		++z.frame_calls;
+		z.frame_ns += end_ns - begin_ns;
+		if (record_trace && zone_is_sliced(zone)) slices.push_back({zone, current_frame, begin_ns, end_ns - begin_ns});
+	}
+
+	// Approximate percentile of the per-frame time, in microseconds, taken
+	// from the upper edge of the histogram bucket it falls in.
+	uint64_t frame_percentile_us(zone_id zone, double p) const {
+		auto& z = zones[zone];
+		uint64_t n = 0;
+		for (auto v : z.histogram) n += v;
+		if (n == 0) return 0;
+		uint64_t target = (uint64_t)(n * p);
+		uint64_t acc = 0;
+		for (size_t i = 0; i != histogram_size; ++i) {
+			acc += z.histogram[i];
+			if (acc > target) return (uint64_t)1 << i;
+		}
+		return (uint64_t)1 << (histogram_size - 1);
+	}
+
+	void print_summary(FILE* f) const {
+		fprintf(f, "%-24s %12s %12s %12s %10s %10s %10s\n", "zone", "calls", "total ms", "us/frame", "p50 us", "p99 us", "max us");
+		for (size_t i = 0; i != zone_count; ++i) {
+			auto& z = zones[i];
+			if (!z.calls) continue;
+			fprintf(f, "%-24s %12llu %12.3f %12.3f %10llu %10llu %10.1f\n", zone_names[i], (unsigned long long)z.calls,
+				z.total_ns / 1000000.0, frames ? z.total_ns / 1000.0 / frames : 0.0,
+				(unsigned long long)frame_percentile_us((zone_id)i, 0.5), (unsigned long long)frame_percentile_us((zone_id)i, 0.99),
+				z.max_frame_ns / 1000.0);
+		}
+	}
+
+	// Chrome trace event format, loadable in chrome://tracing or Perfetto.
+	bool write_chrome_trace(const char* filename) const {
+		FILE* f = fopen(filename, "wb");
+		if (!f) return false;
+		fprintf(f, "{\"traceEvents\":[\n");
+		bool first = true;
+		auto sep = [&]() {
+			if (!first) fprintf(f, ",\n");
+			first = false;
+		};
+		for (auto& s : slices) {
+			sep();
+			fprintf(f, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%d}}",
+				zone_names[s.zone], s.begin_ns / 1000.0, s.duration_ns / 1000.0, s.frame);
+		}
+		for (auto& c : counters) {
+			for (size_t i = 0; i != zone_count; ++i) {
+				if (zone_is_sliced((zone_id)i) || !c.calls[i]) continue;
+				sep();
+				fprintf(f, "{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"args\":{\"calls\":%u,\"us\":%.3f}}",
+					zone_names[i], c.ts_ns / 1000.0, c.calls[i], c.ns[i] / 1000.0);
+			}
+		}
+		fprintf(f, "\n]}\n");
+		fclose(f);
+		return true;
+	}
+};
+
+static inline frame_profiler*& current() {
+	static thread_local frame_profiler* p = nullptr;
+	return p;
+}
+
+static inline void install(frame_profiler* p) {
+	current() = p;
+}
+
+struct scope {
+	frame_profiler* p;
+	zone_id zone;
+	uint64_t begin_ns;
+	explicit scope(zone_id zone) : p(current()), zone(zone) {
+		if (!p) return;
+		// Recursive zones (iscript_execute) are counted on every call but only
+		// timed at the outermost one.
+		if (p->zones[zone].depth++) {
+			++p->zones[zone].frame_calls;
+			return;
+		}
+		begin_ns = p->now_ns();
+	}
+	~scope() {
+		if (!p) return;
+		if (--p->zones[zone].depth) return;
+		p->add(zone, begin_ns, p->now_ns());
+	}
+	scope(const scope&) = delete;
+	scope& operator=(const scope&) = delete;
+};
+
+struct frame_scope {
+	frame_profiler* p;
+	uint64_t begin_ns;
+	explicit frame_scope(int frame) : p(current()) {
+		if (!p) return;
+		p->begin_frame(frame);
+		begin_ns = p->now_ns();
+	}
+	~frame_scope() {
+		if (!p) return;
+		p->add(zone_frame, begin_ns, p->now_ns());
+		p->end_frame();
+	}
+	frame_scope(const frame_scope&) = delete;
+	frame_scope& operator=(const frame_scope&) = delete;
+};
+
+}
+}
+
+#define OPENBW_PROFILE_CONCAT2(a, b) a##b
+#define OPENBW_PROFILE_CONCAT(a, b) OPENBW_PROFILE_CONCAT2(a, b)
+#define OPENBW_PROFILE_ZONE(zone) ::bwgame::profiler::scope OPENBW_PROFILE_CONCAT(openbw_profile_scope_, __LINE__)(::bwgame::profiler::zone)
+#define OPENBW_PROFILE_FRAME(frame) ::bwgame::profiler::frame_scope openbw_profile_frame_scope(frame)
+
+#else
+
+#define OPENBW_PROFILE_ZONE(zone)
+#define OPENBW_PROFILE_FRAME(frame)
+
+#endif
+
+#endif
@@ -10,39 +10,17 @@ namespace bwgame {
 
 namespace data_loading {
 
-struct crc32_t {
-	std::array<uint32_t, 256> table;
-	crc32_t() {
-		for (uint32_t i = 0; i != 256; ++i) {
-			uint32_t v = i;
-			for (size_t b = 0; b != 8; ++b) {
-				v = (v >> 1) ^ (v & 1 ? 0xedb88320 : 0);
-			}
-			table[i] = v;
-		}
-	}
-	uint32_t operator()(const uint8_t* data, size_t data_size) {
-		uint32_t r = 0xffffffff;
-		const uint8_t* end = data + data_size;
-		for (; data != end; ++data) {
-			r = (r >> 8) ^ table[(r ^ *data) & 0xff];
-		}
-		return r;
-	}
-};
-
 template<typename base_reader_T, bool default_little_endian = true>
 struct replay_file_reader {
 	crc32_t crc32;
 	base_reader_T& r;
+	a_vector<uint8_t> compressed_data;
 	replay_file_reader(base_reader_T& r) : r(r) {
 	}
 
 	void get_bytes(uint8_t* output, size_t output_size) {
 		uint32_t crc32_sum = r.template get<uint32_t>();
 		size_t segments = r.template get<uint32_t>();
-		
-		a_vector<uint8_t> compressed_data;
 
 		size_t output_pos = 0;
 		for (size_t i = 0; i != segments; ++i) {
@@ -96,144 +74,198 @@ struct replay_state {
 	int game_type = 0;
 };
 
+// Everything in a replay before the actions and map sections.
+struct replay_header {
+	uint32_t identifier = 0;
+
+	// Object limits; 1.16 limits unless the replay specifies its own.
+	size_t images_limit = 5000;
+	size_t sprites_limit = 2500;
+	size_t units_limit = 1700;
+	size_t bullets_limit = 100;
+	size_t orders_limit = 2000;
+
+	int frame_count = 0;
+	uint32_t random_seed = 0;
+	int map_width = 0;
+	int map_height = 0;
+	int game_type = 0;
+	a_string map_name;
+	int victory_condition = 0;
+	int resource_type = 0;
+	int create_initial_units = 0;
+	int tournament_mode = 0;
+	int starting_minerals = 0;
+
+	std::array<a_string, 12> player_name;
+	std::array<int, 12> slot_player_id;
+	std::array<int, 12> slot_controller;
+	std::array<int, 12> slot_race;
+	std::array<int, 12> slot_force;
+	std::array<uint32_t, 8> player_color;
+	std::array<uint8_t, 8> create_melee_units_for_player;
+};
+
+static const uint32_t replay_magic_classic = 0x53526572;
+static const uint32_t replay_magic_scr = 0x53526573;
+static const uint32_t replay_magic_tr = 0x53526577;
+
+// Reads the replay header and leaves r at the start of the actions section.
+// This only decompresses the small game info section, so it is all that is
+// needed for extracting replay metadata.
+template<typename reader_T>
+replay_header read_replay_header(reader_T&& r) {
+	replay_header h;
+
+	h.identifier = r.template get<uint32_t>();
+	if (h.identifier != replay_magic_classic && h.identifier != replay_magic_tr) {
+		error("load_replay: invalid identifier %#x", h.identifier);
+	}
+
+	// custom block (for now) to specify limits without needing zlib
+	if (h.identifier == replay_magic_tr) {
+		std::array<uint8_t, 0x1c> limits_buffer;
+		r.get_bytes(limits_buffer.data(), limits_buffer.size());
+
+		data_loading::data_reader_le lmts(limits_buffer.data(), limits_buffer.data() + limits_buffer.size());
+
+		h.images_limit = lmts.get<uint32_t>();
+		h.sprites_limit = lmts.get<uint32_t>();
+		lmts.get<uint32_t>(); // thingies
+		h.units_limit = lmts.get<uint32_t>();
+		h.bullets_limit = lmts.get<uint32_t>();
+		h.orders_limit = lmts.get<uint32_t>();
+		lmts.get<uint32_t>(); // fog sprites
+
+	}
+
+	std::array<uint8_t, 633> game_info_buffer;
+	r.get_bytes(game_info_buffer.data(), game_info_buffer.size());
+
+	data_loading::data_reader_le gir(game_info_buffer.data(), game_info_buffer.data() + game_info_buffer.size());
+
+	gir.get<uint8_t>(); // is broodwar
+	h.frame_count = gir.get<uint32_t>();
+	gir.get<uint16_t>(); // campaign id
+	gir.get<uint8_t>(); // command byte ?
+	h.random_seed = gir.get<uint32_t>();
+	gir.get<std::array<uint8_t, 8>>(); // player bytes ?
+	gir.get<uint32_t>(); // ?
+	auto player_name = gir.get<std::array<char, 24>>();
+	gir.get<uint32_t>(); // game flags?
+	h.map_width = gir.get<uint16_t>(); // map width
+	h.map_height = gir.get<uint16_t>(); // map height
+	gir.get<uint8_t>(); // active player acount
+	gir.get<uint8_t>(); // slot count
+	gir.get<uint8_t>(); // game speed
+	gir.get<uint8_t>(); // game state ?
+	h.game_type = gir.get<uint16_t>(); // game type ?
+	gir.get<uint16_t>(); // game sub type ?
+	gir.get<uint32_t>(); // ?
+	gir.get<uint16_t>(); // tileset
+	gir.get<uint8_t>(); // replay autosaved
+	gir.get<uint8_t>(); // computer player count?
+	auto game_name = gir.get<std::array<char, 25>>();
+	auto map_name = gir.get<std::array<char, 32>>();
+	gir.get<uint16_t>(); // game type ?
+	gir.get<uint16_t>(); // game sub type ?
+	gir.get<uint16_t>(); // sub type display ?
+	gir.get<uint16_t>(); // sub type label ?
+	h.victory_condition = gir.get<uint8_t>(); // victory condition
+	h.resource_type = gir.get<uint8_t>(); // resource type
+	gir.get<uint8_t>(); // use standard unit stats
+	gir.get<uint8_t>(); // fog of war enabled
+	h.create_initial_units = gir.get<uint8_t>();
+	gir.get<uint8_t>(); // use fixed positions ?
+	gir.get<uint8_t>(); // restriction flags ?
+	gir.get<uint8_t>(); // allies enabled
+	gir.get<uint8_t>(); // teams enabled
+	gir.get<uint8_t>(); // cheats enabled
+	h.tournament_mode = gir.get<uint8_t>(); // tournament mode ?
+	gir.get<uint32_t>(); // victory condition value?
+	h.starting_minerals = gir.get<uint32_t>(); // starting minerals
+	gir.get<uint32_t>(); // starting gas
+	gir.get<uint8_t>(); // ?
+
+	(void)player_name;
+	(void)game_name;
+
+	auto arr_str = [&](auto& str) {
+		a_string r;
+		for (auto& v : str) {
+			if (!v) break;
+			if ((unsigned char)v >= 21) r += v;
+		}
+		return r;
+	};
+	h.map_name = arr_str(map_name);
+	a_string kn;
+	if (korean::korean_locale_to_utf8(h.map_name, kn)) h.map_name = kn;
+
+	for (size_t i = 0; i != 12; ++i) {
+		gir.get<uint32_t>(); // slot ?
+		h.slot_player_id[i] = gir.get<uint32_t>(); // player id
+		h.slot_controller[i] = gir.get<uint8_t>(); // controller
+		h.slot_race[i] = gir.get<uint8_t>(); // race
+		h.slot_force[i] = gir.get<uint8_t>(); // force
+		auto name = gir.get<std::array<char, 25>>(); // player name
+		h.player_name[i] = arr_str(name);
+	}
+
+	h.player_color = gir.get<std::array<uint32_t, 8>>(); // player colors
+	h.create_melee_units_for_player = gir.get<std::array<uint8_t, 8>>();
+
+	return h;
+}
+
+static inline replay_header read_replay_header_file(a_string filename) {
+	auto file_r = data_loading::file_reader<>(std::move(filename));
+	return read_replay_header(data_loading::make_replay_file_reader(file_r));
+}
+
+static inline replay_header read_replay_header_data(const uint8_t* data, size_t data_size) {
+	auto r = data_loading::data_reader_le(data, data + data_size);
+	return read_replay_header(data_loading::make_replay_file_reader(r));
+}
+
 struct replay_functions: action_functions {
 	replay_state& replay_st;
 	explicit replay_functions(state& st, action_state& action_st, replay_state& replay_st) : action_functions(st, action_st), replay_st(replay_st) {}
 	
 	void load_replay_file(a_string filename, bool initial_processing = true, std::vector<uint8_t>* get_map_data = nullptr) {
-		auto file_r = data_loading::file_reader<>(std::move(filename));
-		load_replay(data_loading::make_replay_file_reader(file_r), initial_processing, get_map_data);
+		data_loading::mapped_file file(std::move(filename));
+		load_replay_data(file.data(), file.size(), initial_processing, get_map_data);
 	}
 	void load_replay_data(const uint8_t* data, size_t data_size, bool initial_processing = true, std::vector<uint8_t>* get_map_data = nullptr) {
 		auto r = data_loading::data_reader_le(data, data + data_size);
 		load_replay(data_loading::make_replay_file_reader(r), initial_processing, get_map_data);
 	}
 
-	const uint32_t MAGIC_CLASSIC = 0x53526572;
-	const uint32_t MAGIC_SCR = 0x53526573;
-	const uint32_t MAGIC_TR = 0x53526577;
+	const uint32_t MAGIC_CLASSIC = replay_magic_classic;
+	const uint32_t MAGIC_SCR = replay_magic_scr;
+	const uint32_t MAGIC_TR = replay_magic_tr;
 
 	template<typename reader_T>
 	void load_replay(reader_T&& r, bool initial_processing = true, std::vector<uint8_t>* get_map_data = nullptr) {
 		
+		replay_header h = read_replay_header(r);
 
-		uint32_t identifier = r.template get<uint32_t>();
-		if (identifier != MAGIC_CLASSIC && identifier != MAGIC_TR) {
-			error("load_replay: invalid identifier %#x", identifier);
-		}
-
-		// default to 1.16 limits
-		st.images_container = 5000;
-		st.units_container = 1700;
-		st.sprites_container = 2500;
-		st.bullets_container = 100;
-		st.orders_container = 2000;
-
-		// custom block (for now) to specify limits without needing zlib
-		if (identifier == MAGIC_TR) {
-			std::array<uint8_t, 0x1c> limits_buffer;
-			r.get_bytes(limits_buffer.data(), limits_buffer.size());
-			
-			data_loading::data_reader_le lmts(limits_buffer.data(), limits_buffer.data() + limits_buffer.size());
-			
-			st.images_container = lmts.get<uint32_t>();
-			st.sprites_container = lmts.get<uint32_t>();
-			lmts.get<uint32_t>(); // thingies
-			st.units_container = lmts.get<uint32_t>();
-			st.bullets_container = lmts.get<uint32_t>();
-			st.orders_container = lmts.get<uint32_t>();
-			lmts.get<uint32_t>(); // fog sprites
-
-		}
+		st.images_container = h.images_limit;
+		st.units_container = h.units_limit;
+		st.sprites_container = h.sprites_limit;
+		st.bullets_container = h.bullets_limit;
+		st.orders_container = h.orders_limit;
 
 		unit_id::unit_generation_size = st.units_container.max_size == 1700 ? 5 : 3;
 
-
-		std::array<uint8_t, 633> game_info_buffer;
-		r.get_bytes(game_info_buffer.data(), game_info_buffer.size());
-		
-		data_loading::data_reader_le gir(game_info_buffer.data(), game_info_buffer.data() + game_info_buffer.size());
-		
-		gir.get<uint8_t>(); // is broodwar
-		auto frame_count = gir.get<uint32_t>();
-		gir.get<uint16_t>(); // campaign id
-		gir.get<uint8_t>(); // command byte ?
-		uint32_t random_seed = gir.get<uint32_t>();
-		gir.get<std::array<uint8_t, 8>>(); // player bytes ?
-		gir.get<uint32_t>(); // ?
-		auto player_name = gir.get<std::array<char, 24>>();
-		gir.get<uint32_t>(); // game flags?
-		gir.get<uint16_t>(); // map width
-		gir.get<uint16_t>(); // map height
-		gir.get<uint8_t>(); // active player acount
-		gir.get<uint8_t>(); // slot count
-		gir.get<uint8_t>(); // game speed
-		gir.get<uint8_t>(); // game state ?
-		auto game_type = gir.get<uint16_t>(); // game type ?
-		gir.get<uint16_t>(); // game sub type ?
-		gir.get<uint32_t>(); // ?
-		gir.get<uint16_t>(); // tileset
-		gir.get<uint8_t>(); // replay autosaved
-		gir.get<uint8_t>(); // computer player count?
-		auto game_name = gir.get<std::array<char, 25>>();
-		auto map_name = gir.get<std::array<char, 32>>();
-		gir.get<uint16_t>(); // game type ?
-		gir.get<uint16_t>(); // game sub type ?
-		gir.get<uint16_t>(); // sub type display ?
-		gir.get<uint16_t>(); // sub type label ?
-		auto victory_condition = gir.get<uint8_t>(); // victory condition
-		int resource_type = gir.get<uint8_t>(); // resource type
-		gir.get<uint8_t>(); // use standard unit stats
-		gir.get<uint8_t>(); // fog of war enabled
-		auto create_initial_units = gir.get<uint8_t>();
-		gir.get<uint8_t>(); // use fixed positions ?
-		gir.get<uint8_t>(); // restriction flags ?
-		gir.get<uint8_t>(); // allies enabled
-		gir.get<uint8_t>(); // teams enabled
-		gir.get<uint8_t>(); // cheats enabled
-		auto tournament_mode = gir.get<uint8_t>(); // tournament mode ?
-		gir.get<uint32_t>(); // victory condition value?
-		auto starting_minerals = gir.get<uint32_t>(); // starting minerals
-		gir.get<uint32_t>(); // starting gas
-		gir.get<uint8_t>(); // ?
-		
-		(void)player_name;
-		(void)game_name;
-		
-		auto arr_str = [&](auto& str) {
-			a_string r;
-			for (auto& v : str) {
-				if (!v) break;
-				if ((unsigned char)v >= 21) r += v;
-			}
-			return r;
-		};
-		replay_st.map_name = arr_str(map_name);
-		a_string kn;
-		if (korean::korean_locale_to_utf8(replay_st.map_name, kn)) replay_st.map_name = kn;
-		
-		std::array<int, 12> slot_player_id;
-		std::array<int, 12> slot_controller;
-		std::array<int, 12> slot_race;
-		std::array<int, 12> slot_force;
-		
+		replay_st.map_name = h.map_name;
 		for (size_t i = 0; i != 12; ++i) {
-			gir.get<uint32_t>(); // slot ?
-			slot_player_id[i] = gir.get<uint32_t>(); // player id
-			slot_controller[i] = gir.get<uint8_t>(); // controller
-			slot_race[i] = gir.get<uint8_t>(); // race
-			slot_force[i] = gir.get<uint8_t>(); // force
-			auto name = gir.get<std::array<char, 25>>(); // player name
-			replay_st.player_name[i] = arr_str(name);
-			
-			action_st.player_id[i] = slot_player_id[i];
+			replay_st.player_name[i] = h.player_name[i];
+			action_st.player_id[i] = h.slot_player_id[i];
 		}
 		
-		auto player_color = gir.get<std::array<uint32_t, 8>>(); // player colors
-		auto create_melee_units_for_player = gir.get<std::array<uint8_t, 8>>();
-		
-		replay_st.end_frame = frame_count;
-		replay_st.game_type = game_type;
+		replay_st.end_frame = h.frame_count;
+		replay_st.game_type = h.game_type;
 		
 		replay_st.actions_data_buffer.resize(r.template get<uint32_t>());
 		r.get_bytes(replay_st.actions_data_buffer.data(), replay_st.actions_data_buffer.size());
@@ -246,21 +278,21 @@ struct replay_functions: action_functions {
 		
 		game_load_functions game_load_funcs(st);
 		game_load_funcs.load_map_data(map_buffer.data(), map_buffer.size(), [&]() {
-			game_load_funcs.setup_info.victory_condition = victory_condition;
-			game_load_funcs.setup_info.starting_units = create_initial_units;
-			game_load_funcs.setup_info.tournament_mode = tournament_mode;
-			game_load_funcs.setup_info.resource_type = resource_type;
-			game_load_funcs.setup_info.starting_minerals = starting_minerals;
+			game_load_funcs.setup_info.victory_condition = h.victory_condition;
+			game_load_funcs.setup_info.starting_units = h.create_initial_units;
+			game_load_funcs.setup_info.tournament_mode = h.tournament_mode;
+			game_load_funcs.setup_info.resource_type = h.resource_type;
+			game_load_funcs.setup_info.starting_minerals = h.starting_minerals;
 			for (size_t i = 0; i != 12; ++i) {
-				st.players[i].controller = slot_controller[i];
-				st.players[i].race = (race_t)slot_race[i];
-				st.players[i].force = slot_force[i];
-				if (victory_condition == 0 && tournament_mode == 0) {
+				st.players[i].controller = h.slot_controller[i];
+				st.players[i].race = (race_t)h.slot_race[i];
+				st.players[i].force = h.slot_force[i];
+				if (h.victory_condition == 0 && h.tournament_mode == 0) {
 					if (i >= 8) game_load_funcs.setup_info.create_melee_units_for_player[i] = false;
-					else game_load_funcs.setup_info.create_melee_units_for_player[i] = create_melee_units_for_player[i] != 0;
+					else game_load_funcs.setup_info.create_melee_units_for_player[i] = h.create_melee_units_for_player[i] != 0;
 				}
 			}
-			st.lcg_rand_state = random_seed;
+			st.lcg_rand_state = h.random_seed;
 		}, initial_processing);
 		
 		std::array<int, 8> source_colors;
@@ -268,7 +300,7 @@ struct replay_functions: action_functions {
 			source_colors[i] = st.players[i].color;
 		}
 		for (size_t i = 0; i != 8; ++i) {
-			st.players[i].color = source_colors.at(player_color[i]);
+			st.players[i].color = source_colors.at(h.player_color[i]);
 		}
 	}
 	
@@ -559,8 +559,10 @@ struct replay_saver_functions {
 		w.put_bytes(data, data_size);
 	}
 	
+	// Only the first history_size_limit bytes of the action history are
+	// written, which lets the caller leave out actions that are not final.
 	template<typename writer_T>
-	void save_replay(int current_frame, writer_T& w) {
+	void save_replay(int current_frame, writer_T& w, size_t history_size_limit = ~(size_t)0) {
 		std::array<uint8_t, 633> game_info_buffer;
 		data_loading::data_writer<> giw(game_info_buffer.data(), game_info_buffer.data() + game_info_buffer.size());
 		
@@ -636,11 +638,13 @@ struct replay_saver_functions {
 		
 		size_t history_size = 0;
 		for (auto& v : replay_saver_st.history) history_size += v.size();
+		if (history_size > history_size_limit) history_size = history_size_limit;
 		rw.template put<uint32_t>(history_size);
 		a_vector<uint8_t> tmp_buf;
 		tmp_buf.reserve(history_size);
 		for (auto& v : replay_saver_st.history) {
-			tmp_buf.insert(tmp_buf.end(), v.begin(), v.end());
+			size_t n = std::min(v.size(), history_size - tmp_buf.size());
+			tmp_buf.insert(tmp_buf.end(), v.begin(), v.begin() + n);
 		}
 		rw.put_bytes(tmp_buf.data(), tmp_buf.size());
 		
@@ -0,0 +1,91 @@
+#ifndef BWGAME_SPSC_QUEUE_H
+#define BWGAME_SPSC_QUEUE_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+namespace bwgame {
+
+// Unbounded lock-free queue for exactly one producer thread and one consumer
+// thread. Elements are stored in fixed size blocks that are linked together
+// as the producer runs out of space; the consumer frees a block once it has
+// read past the end of it.
+template<typename T, size_t block_size = 64>
+struct spsc_queue {
+	static_assert(block_size >= 2, "spsc_queue: block_size too small");
+
+	struct block_t {
+		std::array<T, block_size> values;
+		std::atomic<block_t*> next{nullptr};
+	};
+
+	// Consumer side.
+	block_t* head_block;
+	size_t head_index = 0;
+	size_t popped = 0;
+
+	// Producer side.
+	alignas(64) block_t* tail_block;
+	size_t tail_index = 0;
+	size_t pushed = 0;
+
+	// Written by the producer, read by the consumer.
+	alignas(64) std::atomic<size_t> published{0};
+
+	spsc_queue() {
+		head_block = tail_block = new block_t();
+	}
+	spsc_queue(const spsc_queue&) = delete;
+	spsc_queue& operator=(const spsc_queue&) = delete;
+	~spsc_queue() {
+		block_t* b = head_block;
+		while (b) {
+			block_t* next = b->next.load(std::memory_order_relaxed);
+			delete b;
+			b = next;
+		}
+	}
+
+	// Producer only.
+	template<typename V>
+	void push(V&& v) {
+		if (tail_index == block_size) {
+			block_t* b = new block_t();
+			tail_block->next.store(b, std::memory_order_release);
+			tail_block = b;
+			tail_index = 0;
+		}
+		tail_block->values[tail_index] = std::forward<V>(v);
+		++tail_index;
+		++pushed;
+		published.store(pushed, std::memory_order_release);
+	}
+
+	// Consumer only.
+	bool empty() const {
+		return published.load(std::memory_order_acquire) == popped;
+	}
+
+	// Consumer only. Moves the oldest element into r and returns true, or
+	// returns false if the queue is empty.
+	bool pop(T& r) {
+		if (published.load(std::memory_order_acquire) == popped) return false;
+		if (head_index == block_size) {
+			block_t* next = head_block->next.load(std::memory_order_acquire);
+			delete head_block;
+			head_block = next;
+			head_index = 0;
+		}
+		r = std::move(head_block->values[head_index]);
+		head_block->values[head_index] = T();
+		++head_index;
+		++popped;
+		return true;
+	}
+};
+
+}
+
+#endif
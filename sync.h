@@ -186,6 +186,10 @@ struct sync_functions: action_functions {
 	explicit sync_functions(state& st, action_state& action_st, sync_state& sync_st) : action_functions(st, action_st), sync_st(sync_st) {}
 
 	std::function<void(int player_slot, data_loading::data_reader_le&)> on_custom_action;
+	// Called with every escape message other than insync checks (create,
+	// kill and remove unit, custom actions), starting at the message id, right
+	// before it is executed.
+	std::function<void(int player_slot, const uint8_t* data, size_t size)> on_escape_message;
 
 	template<typename action_F>
 	void execute_scheduled_actions(action_F&& action_f) {
@@ -358,7 +362,11 @@ struct sync_functions: action_functions {
 		sync_state& sync_st;
 		syncer_t(sync_functions& funcs, server_T& server) : funcs(funcs), server(server), st(funcs.st), sync_st(funcs.sync_st) {}
 
-		const uint32_t greeting_value = 0x39e25069;
+		// Doubles as the protocol version: it must change whenever the messages
+		// or the insync hash change, so that incompatible clients refuse each
+		// other at the greeting instead of reporting a desync later.
+		// 0x39e25069 was the last value before insync checks used state_hash.
+		const uint32_t greeting_value = 0x5d1c0e37;
 
 		void send(const uint8_t* data, size_t size, const void* h = nullptr) {
 			if (size == 0) error("attempt to send no data");
@@ -630,19 +638,9 @@ struct sync_functions: action_functions {
 			};
 			add(sync_st.successful_action_count);
 			add(sync_st.failed_action_count);
-			add(st.lcg_rand_state);
-			for (auto v : st.current_minerals) add(v);
-			for (auto v : st.current_gas) add(v);
-			for (auto v : st.total_minerals_gathered) add(v);
-			for (auto v : st.total_gas_gathered) add(v);
-			add(st.active_orders_size);
-			add(st.active_bullets_size);
-			add(st.active_thingies_size);
-			for (unit_t* u : ptr(st.visible_units)) {
-				add((u->shield_points + u->hp).raw_value);
-				add(u->exact_position.x.raw_value);
-				add(u->exact_position.y.raw_value);
-			}
+			uint64_t full_hash = state_hash(st);
+			add(full_hash);
+			add(full_hash >> 32);
 
 			if (sync_st.insync_hash_index == sync_st.insync_hash.size() - 1) sync_st.insync_hash_index = 0;
 			else ++sync_st.insync_hash_index;
@@ -790,7 +788,12 @@ struct sync_functions: action_functions {
 						if (client->player_slot != -1) {
 							int sync_message_id = r.template get<uint8_t>();
 							if (sync_message_id == sync_messages::id_game_started_escape) {
+								const uint8_t* message_data = r.ptr;
+								size_t message_size = r.left();
 								int id = r.template get<uint8_t>();
+								if (id != sync_messages::id_insync_check && funcs.on_escape_message) {
+									funcs.on_escape_message(client->player_slot, message_data, message_size);
+								}
 								switch (id) {
 								case sync_messages::id_insync_check: {
 									uint8_t index = r.template get<uint8_t>();
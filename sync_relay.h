@@ -0,0 +1,385 @@
+#ifndef BWGAME_SYNC_RELAY_H
+#define BWGAME_SYNC_RELAY_H
+
+#include "sync.h"
+
+namespace bwgame {
+
+// A relay joins a sync game as a client that never occupies a player slot,
+// and rebroadcasts the action stream of the game to read-only spectators
+// connected to a separate server. Spectators never talk to the players, so
+// the number of spectators adds no load to the lockstep loop. Each spectator
+// runs its own simulation from the stream, like a replay that keeps growing.
+//
+// The stream is the action history recorded by replay_saver, so the relay's
+// sync_state::save_replay must be set up (including map_data) before the game
+// starts. Escape messages (create_unit, kill_unit, remove_unit and custom
+// actions) are not part of a replay, so they are sent alongside it, tagged
+// with the frame and the position in the action history they were executed
+// at. The relay also sends a state hash every insync_check_interval frames,
+// which spectators check against their own state.
+
+namespace sync_relay_messages {
+	enum {
+		id_replay_data,
+		id_replay_end,
+		id_actions,
+		id_escape_message,
+		id_state_hash
+	};
+}
+
+struct sync_relay_state {
+	// Actions are held back until the relay is this many frames past them.
+	int delay_frames = 0;
+	// Actions are sent once at least this many frames are ready.
+	int batch_frames = 1;
+
+	struct checkpoint_t {
+		int frame;
+		size_t history_size;
+	};
+	a_deque<checkpoint_t> checkpoints;
+	int published_frame = 0;
+	size_t published_history_size = 0;
+	int sent_frame = 0;
+	size_t sent_history_size = 0;
+
+	struct escape_message_t {
+		int frame;
+		size_t history_size;
+		int player_slot;
+		a_vector<uint8_t> data;
+	};
+	a_vector<escape_message_t> escape_messages;
+	size_t sent_escape_messages = 0;
+
+	struct state_hash_t {
+		int frame;
+		uint64_t hash;
+	};
+	a_vector<state_hash_t> state_hashes;
+	size_t sent_state_hashes = 0;
+
+	a_vector<const void*> spectators;
+	a_vector<const void*> new_spectators;
+	a_vector<uint8_t> buffer;
+};
+
+struct sync_relay_functions {
+	sync_functions& funcs;
+	sync_relay_state& relay_st;
+	// Takes over funcs.on_escape_message.
+	sync_relay_functions(sync_functions& funcs, sync_relay_state& relay_st) : funcs(funcs), relay_st(relay_st) {
+		funcs.on_escape_message = [this](int player_slot, const uint8_t* data, size_t size) {
+			on_escape_message(player_slot, data, size);
+		};
+	}
+
+	const size_t max_chunk_size = 0xff00;
+	const int insync_check_interval = 32;
+
+	replay_saver_state& replay_saver_st() {
+		if (!funcs.sync_st.save_replay) error("sync_relay: sync_state::save_replay is null");
+		return *funcs.sync_st.save_replay;
+	}
+
+	size_t history_size() {
+		size_t r = 0;
+		for (auto& v : replay_saver_st().history) r += v.size();
+		return r;
+	}
+
+	void copy_history(size_t begin, size_t end, a_vector<uint8_t>& dst) {
+		dst.clear();
+		size_t pos = 0;
+		for (auto& v : replay_saver_st().history) {
+			if (pos >= end) break;
+			size_t from = std::max(begin, pos);
+			size_t to = std::min(end, pos + v.size());
+			if (from < to) dst.insert(dst.end(), v.begin() + (from - pos), v.begin() + (to - pos));
+			pos += v.size();
+		}
+	}
+
+	void on_escape_message(int player_slot, const uint8_t* data, size_t size) {
+		relay_st.escape_messages.push_back({funcs.st.current_frame, history_size(), player_slot, a_vector<uint8_t>(data, data + size)});
+		// Start a new block for any further actions this frame, so that the
+		// message falls between two blocks of the spectators' action data.
+		replay_saver_st().current_history_frame = -1;
+	}
+
+	template<typename server_T>
+	void send_escape_message(server_T& server, const sync_relay_state::escape_message_t& e, const void* h) {
+		auto m = server.new_message();
+		m.template put<uint8_t>(sync_relay_messages::id_escape_message);
+		m.template put<uint32_t>(e.frame);
+		m.template put<uint32_t>(e.history_size);
+		m.template put<uint8_t>(e.player_slot);
+		m.put(e.data.data(), e.data.size());
+		server.send_message(m, h);
+	}
+
+	template<typename server_T>
+	void send_state_hash(server_T& server, const sync_relay_state::state_hash_t& v, const void* h) {
+		auto m = server.new_message();
+		m.template put<uint8_t>(sync_relay_messages::id_state_hash);
+		m.template put<uint32_t>(v.frame);
+		m.template put<uint64_t>(v.hash);
+		server.send_message(m, h);
+	}
+
+	template<typename server_T>
+	void remove_spectator(server_T& server, const void* h) {
+		auto remove = [&](a_vector<const void*>& vec) {
+			auto i = std::find(vec.begin(), vec.end(), h);
+			if (i != vec.end()) vec.erase(i);
+		};
+		remove(relay_st.spectators);
+		remove(relay_st.new_spectators);
+		server.kill_client(h);
+	}
+
+	template<typename server_T>
+	void on_new_spectator(server_T& server, const void* h) {
+		// Spectators are left out of broadcasts until they have been sent the
+		// replay up to sent_frame.
+		server.allow_send(h, false);
+		server.set_on_message(h, [](const void*, size_t) {});
+		server.set_on_kill(h, [this, &server, h]() {
+			remove_spectator(server, h);
+		});
+		relay_st.new_spectators.push_back(h);
+	}
+
+	template<typename server_T>
+	void send_actions(server_T& server) {
+		// Escape messages and hashes go first, so spectators have them before
+		// end_frame lets them play the frames they belong to.
+		auto& escape_messages = relay_st.escape_messages;
+		while (relay_st.sent_escape_messages != escape_messages.size() && escape_messages[relay_st.sent_escape_messages].frame < relay_st.published_frame) {
+			send_escape_message(server, escape_messages[relay_st.sent_escape_messages++], nullptr);
+		}
+		auto& state_hashes = relay_st.state_hashes;
+		while (relay_st.sent_state_hashes != state_hashes.size() && state_hashes[relay_st.sent_state_hashes].frame <= relay_st.published_frame) {
+			send_state_hash(server, state_hashes[relay_st.sent_state_hashes++], nullptr);
+		}
+		copy_history(relay_st.sent_history_size, relay_st.published_history_size, relay_st.buffer);
+		size_t pos = 0;
+		do {
+			size_t n = std::min(relay_st.buffer.size() - pos, max_chunk_size);
+			bool last = pos + n == relay_st.buffer.size();
+			auto m = server.new_message();
+			m.template put<uint8_t>(sync_relay_messages::id_actions);
+			// end_frame only moves on the last chunk, so a spectator never
+			// plays a frame whose actions have not all arrived.
+			m.template put<uint32_t>(last ? relay_st.published_frame : relay_st.sent_frame);
+			if (n) m.put(relay_st.buffer.data() + pos, n);
+			server.send_message(m, nullptr);
+			pos += n;
+		} while (pos != relay_st.buffer.size());
+		relay_st.sent_frame = relay_st.published_frame;
+		relay_st.sent_history_size = relay_st.published_history_size;
+	}
+
+	template<typename server_T>
+	void send_replay(server_T& server) {
+		sync_functions::dynamic_writer<> w(0x10000);
+		replay_saver_functions(replay_saver_st()).save_replay(relay_st.sent_frame, w, relay_st.sent_history_size);
+		for (const void* h : relay_st.new_spectators) server.allow_send(h, true);
+		for (size_t pos = 0; pos != w.size();) {
+			size_t n = std::min(w.size() - pos, max_chunk_size);
+			auto m = server.new_message();
+			m.template put<uint8_t>(sync_relay_messages::id_replay_data);
+			m.put(w.data() + pos, n);
+			for (const void* h : relay_st.new_spectators) server.send_message(m, h);
+			pos += n;
+		}
+		auto m = server.new_message();
+		m.template put<uint8_t>(sync_relay_messages::id_replay_end);
+		for (const void* h : relay_st.new_spectators) server.send_message(m, h);
+		for (const void* h : relay_st.new_spectators) {
+			for (size_t i = 0; i != relay_st.sent_escape_messages; ++i) send_escape_message(server, relay_st.escape_messages[i], h);
+			for (size_t i = 0; i != relay_st.sent_state_hashes; ++i) send_state_hash(server, relay_st.state_hashes[i], h);
+		}
+		relay_st.spectators.insert(relay_st.spectators.end(), relay_st.new_spectators.begin(), relay_st.new_spectators.end());
+		relay_st.new_spectators.clear();
+	}
+
+	// Should be called once after every next_frame of the relay's game.
+	template<typename server_T>
+	void update(server_T& server) {
+		server.poll([this, &server](const void* h) {
+			on_new_spectator(server, h);
+		});
+		if (!funcs.sync_st.game_started) return;
+		int frame = funcs.st.current_frame;
+		if (relay_st.checkpoints.empty() || relay_st.checkpoints.back().frame != frame) {
+			relay_st.checkpoints.push_back({frame, history_size()});
+			if (frame % insync_check_interval == 0) relay_st.state_hashes.push_back({frame, state_hash(funcs.st)});
+		}
+		while (!relay_st.checkpoints.empty() && relay_st.checkpoints.front().frame + relay_st.delay_frames <= frame) {
+			relay_st.published_frame = relay_st.checkpoints.front().frame;
+			relay_st.published_history_size = relay_st.checkpoints.front().history_size;
+			relay_st.checkpoints.pop_front();
+		}
+		if (relay_st.published_frame - relay_st.sent_frame >= relay_st.batch_frames) send_actions(server);
+		if (!relay_st.new_spectators.empty()) send_replay(server);
+	}
+
+	// Sends everything recorded so far, ignoring delay_frames and batch_frames.
+	template<typename server_T>
+	void flush(server_T& server) {
+		if (!relay_st.checkpoints.empty()) {
+			relay_st.published_frame = relay_st.checkpoints.back().frame;
+			relay_st.published_history_size = relay_st.checkpoints.back().history_size;
+			relay_st.checkpoints.clear();
+		}
+		if (relay_st.published_frame != relay_st.sent_frame) send_actions(server);
+	}
+};
+
+struct sync_spectator_state {
+	a_vector<uint8_t> replay_data;
+	bool has_replay = false;
+
+	struct escape_message_t {
+		int frame;
+		size_t actions_data_position;
+		int player_slot;
+		a_vector<uint8_t> data;
+	};
+	a_deque<escape_message_t> escape_messages;
+	a_deque<std::pair<int, uint64_t>> state_hashes;
+};
+
+// Plays the stream from a relay. The state must be freshly initialized, as
+// for replay_functions::load_replay. Frames must be advanced with next_frame
+// of this class, which also executes escape messages and checks the relay's
+// state hashes.
+struct sync_spectator_functions: replay_functions {
+	sync_spectator_state& spectator_st;
+	sync_spectator_functions(state& st, action_state& action_st, replay_state& replay_st, sync_spectator_state& spectator_st) : replay_functions(st, action_st, replay_st), spectator_st(spectator_st) {}
+
+	std::function<void(int player_slot, data_loading::data_reader_le&)> on_custom_action;
+
+	void add_actions(const uint8_t* data, size_t size, int end_frame) {
+		auto& buffer = replay_st.actions_data_buffer;
+		// execute_actions stops looking for more actions once it has read the
+		// whole buffer, so point it at the current frame again.
+		if (action_st.actions_data_position == buffer.size()) action_st.next_action_frame = st.current_frame;
+		buffer.insert(buffer.end(), data, data + size);
+		replay_st.end_frame = end_frame;
+	}
+
+	void on_message(const void* data, size_t size) {
+		data_loading::data_reader_le r((const uint8_t*)data, (const uint8_t*)data + size);
+		int id = r.get<uint8_t>();
+		switch (id) {
+		case sync_relay_messages::id_replay_data:
+			spectator_st.replay_data.insert(spectator_st.replay_data.end(), r.ptr, r.ptr + r.left());
+			break;
+		case sync_relay_messages::id_replay_end:
+			if (spectator_st.has_replay) error("sync_spectator: received a second replay");
+			load_replay_data(spectator_st.replay_data.data(), spectator_st.replay_data.size());
+			spectator_st.replay_data = {};
+			spectator_st.has_replay = true;
+			break;
+		case sync_relay_messages::id_actions: {
+			if (!spectator_st.has_replay) error("sync_spectator: received actions before the replay");
+			int end_frame = (int)r.get<uint32_t>();
+			add_actions(r.ptr, r.left(), end_frame);
+			break;
+		}
+		case sync_relay_messages::id_escape_message: {
+			int frame = (int)r.get<uint32_t>();
+			if (spectator_st.has_replay && frame < st.current_frame) error("sync_spectator: received an escape message for frame %d after playing it", frame);
+			size_t position = r.get<uint32_t>();
+			int player_slot = r.get<uint8_t>();
+			spectator_st.escape_messages.push_back({frame, position, player_slot, a_vector<uint8_t>(r.ptr, r.ptr + r.left())});
+			break;
+		}
+		case sync_relay_messages::id_state_hash: {
+			int frame = (int)r.get<uint32_t>();
+			uint64_t hash = r.get<uint64_t>();
+			spectator_st.state_hashes.emplace_back(frame, hash);
+			break;
+		}
+		default: error("sync_spectator: unknown message id %d", id);
+		}
+	}
+
+	void execute_escape_message(const sync_spectator_state::escape_message_t& e) {
+		data_loading::data_reader_le r(e.data.data(), e.data.data() + e.data.size());
+		switch (r.get<uint8_t>()) {
+		case sync_messages::id_create_unit: {
+			const unit_type_t* unit_type = get_unit_type((UnitTypes)r.get<uint32_t>());
+			int x = r.get<int32_t>();
+			int y = r.get<int32_t>();
+			int owner = r.get<uint8_t>();
+			trigger_create_unit(unit_type, {x, y}, owner);
+			break;
+		}
+		case sync_messages::id_kill_unit: {
+			unit_t* u = get_unit(unit_id_32(r.get<uint32_t>()));
+			if (u) state_functions::kill_unit(u);
+			break;
+		}
+		case sync_messages::id_remove_unit: {
+			unit_t* u = get_unit(unit_id_32(r.get<uint32_t>()));
+			if (u) {
+				hide_unit(u);
+				state_functions::kill_unit(u);
+			}
+			break;
+		}
+		case sync_messages::id_custom_action:
+			if (on_custom_action) on_custom_action(e.player_slot, r);
+			break;
+		}
+	}
+
+	void next_frame() {
+		if (st.current_frame == replay_st.end_frame) error("replay: attempt to play past end");
+		auto& buffer = replay_st.actions_data_buffer;
+		// The relay executed each escape message between two blocks of
+		// actions, so run the actions up to that point first.
+		while (!spectator_st.escape_messages.empty() && spectator_st.escape_messages.front().frame == st.current_frame) {
+			auto& e = spectator_st.escape_messages.front();
+			if (e.actions_data_position > buffer.size()) error("sync_spectator: escape message is past the end of the action data");
+			execute_actions(buffer.data(), buffer.data() + e.actions_data_position);
+			if (action_st.actions_data_position != e.actions_data_position) error("sync_spectator: escape message is not between two blocks of actions");
+			execute_escape_message(e);
+			spectator_st.escape_messages.pop_front();
+		}
+		execute_actions(buffer.data(), buffer.data() + buffer.size());
+		state_functions::next_frame();
+		while (!spectator_st.state_hashes.empty() && spectator_st.state_hashes.front().first <= st.current_frame) {
+			auto v = spectator_st.state_hashes.front();
+			spectator_st.state_hashes.pop_front();
+			if (v.first == st.current_frame && state_hash(st) != v.second) error("sync_spectator: state hash mismatch at frame %d", v.first);
+		}
+	}
+
+	// Processes any messages from the relay without blocking.
+	template<typename server_T>
+	void update(server_T& server) {
+		server.poll([this, &server](const void* h) {
+			server.set_on_message(h, [this](const void* data, size_t size) {
+				on_message(data, size);
+			});
+			server.set_on_kill(h, [&server, h]() {
+				server.kill_client(h);
+			});
+		});
+	}
+
+	// Whether the next frame has been received and can be simulated.
+	bool can_advance() {
+		return spectator_st.has_replay && st.current_frame < replay_st.end_frame;
+	}
+};
+
+}
+
+#endif
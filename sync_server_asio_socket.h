@@ -54,47 +54,81 @@ struct sync_server_asio_socket {
 	}
 	
 	const size_t recv_size = 0x1000;
-	
+
+	// Messages are encoded once into a single buffer from a pool of size
+	// classes, and recipients share that buffer by reference. The largest
+	// class fits the 2 byte length prefix plus the maximum message size.
+	static const size_t max_message_size = 0xffff;
+	static const size_t send_buffer_size_classes = 6;
+	static size_t send_buffer_class_size(size_t index) {
+		if (index == send_buffer_size_classes - 1) return 2 + max_message_size;
+		return (size_t)0x40 << (2 * index);
+	}
+	static size_t send_buffer_class_for(size_t n) {
+		size_t index = 0;
+		while (send_buffer_class_size(index) < n) ++index;
+		return index;
+	}
+
 	struct send_buffer_t {
-		std::array<uint8_t, 0x2000> buffer;
+		a_vector<uint8_t> buffer;
+		size_t size_class = 0;
 		int refcount = 0;
-		size_t pos = 0;
 	};
-	
-	using send_buffers_t = a_list<send_buffer_t>;
-	send_buffers_t send_buffers;
-	
+
+	a_list<send_buffer_t> send_buffers;
+	std::array<a_vector<send_buffer_t*>, send_buffer_size_classes> free_send_buffers;
+
+	send_buffer_t* acquire_send_buffer(size_t n) {
+		if (n > 2 + max_message_size) error("acquire_send_buffer: message too large (%d bytes)", n);
+		size_t index = send_buffer_class_for(n);
+		auto& free_list = free_send_buffers[index];
+		if (!free_list.empty()) {
+			send_buffer_t* r = free_list.back();
+			free_list.pop_back();
+			return r;
+		}
+		send_buffers.emplace_back();
+		send_buffer_t* r = &send_buffers.back();
+		r->buffer.resize(send_buffer_class_size(index));
+		r->size_class = index;
+		return r;
+	}
+
+	void release_send_buffer(send_buffer_t* buffer) {
+		free_send_buffers[buffer->size_class].push_back(buffer);
+	}
+
 	struct message_buffer_handle {
 		sync_server_asio_socket* server = nullptr;
-		typename send_buffers_t::iterator buffer;
+		send_buffer_t* buffer = nullptr;
 		size_t offset = 0;
 		size_t size = 0;
 		message_buffer_handle() = default;
-		message_buffer_handle(sync_server_asio_socket& server, typename send_buffers_t::iterator buffer) : server(&server), buffer(buffer) {
+		message_buffer_handle(sync_server_asio_socket& server, send_buffer_t* buffer) : server(&server), buffer(buffer) {
 			++buffer->refcount;
 		}
-		message_buffer_handle(const message_buffer_handle& n) {
-			server = n.server;
-			buffer = n.buffer;
-			offset = n.offset;
-			size = n.size;
-			if (server) ++buffer->refcount;
+		message_buffer_handle(const message_buffer_handle& n) : server(n.server), buffer(n.buffer), offset(n.offset), size(n.size) {
+			if (buffer) ++buffer->refcount;
+		}
+		message_buffer_handle(message_buffer_handle&& n) : server(n.server), buffer(n.buffer), offset(n.offset), size(n.size) {
+			n.buffer = nullptr;
 		}
-		message_buffer_handle& operator=(const message_buffer_handle& n) {
-			server = n.server;
-			buffer = n.buffer;
-			offset = n.offset;
-			size = n.size;
-			if (server) ++buffer->refcount;
+		message_buffer_handle& operator=(message_buffer_handle n) {
+			std::swap(server, n.server);
+			std::swap(buffer, n.buffer);
+			std::swap(offset, n.offset);
+			std::swap(size, n.size);
 			return *this;
 		}
 		~message_buffer_handle() {
-			if (server && --buffer->refcount == 0) {
-				server->send_buffers.splice(server->send_buffers.begin(), server->send_buffers, buffer);
-			}
+			if (buffer && --buffer->refcount == 0) server->release_send_buffer(buffer);
+		}
+		const uint8_t* data() const {
+			return buffer->buffer.data() + offset;
 		}
 	};
-	
+
 	struct client_t {
 		client_t(socket_T socket) : socket(std::move(socket)) {}
 		typename a_list<client_t>::iterator my_it;
@@ -110,19 +144,23 @@ struct sync_server_asio_socket {
 	};
 	
 	a_list<client_t> clients;
-	
-	typename send_buffers_t::iterator get_send_buffer_with_space(size_t n) {
-		for (auto i = send_buffers.begin(); i != send_buffers.end(); ++i) {
-			if (i->buffer.size() - i->pos >= n) return i;
+
+	~sync_server_asio_socket() {
+		// Outstanding handlers refer to clients, so let them finish before
+		// clients is destroyed rather than in the io_service destructor.
+		for (auto& c : clients) {
+			c.on_kill = {};
+			c.on_message = {};
+			if (c.socket.is_open()) c.socket.close();
 		}
-		send_buffers.emplace_back();
-		return std::prev(send_buffers.end());
+		timer.cancel();
+		io_service.reset();
+		io_service.poll();
 	}
-	
+
 	struct message_t {
 		sync_server_asio_socket& server;
-		static_vector<message_buffer_handle, 2> buffers;
-		size_t total_size = 0;
+		message_buffer_handle buffer;
 		template<typename T>
 		void put(T v) {
 			std::array<uint8_t, sizeof(T)> buf;
@@ -130,60 +168,63 @@ struct sync_server_asio_socket {
 			put(buf.data(), buf.size());
 		}
 		void put(const void* data, size_t size) {
-			auto* buf = &*buffers.back().buffer;
-			size_t left = buf->buffer.size() - buf->pos;
-			if (left >= size) {
-				memcpy(buf->buffer.data() + buf->pos, data, size);
-				buf->pos += size;
-				buffers.back().size += size;
-				total_size += size;
-			} else {
-				memcpy(buf->buffer.data() + buf->pos, data, left);
-				buf->pos += left;
-				buffers.back().size += left;
-				total_size += left;
-				if (buffers.size() == buffers.max_size()) error("message_t: too much data :(");
-				buffers.emplace_back(server, server.get_send_buffer_with_space(size - left));
-				buffers.back().offset = buffers.back().buffer->pos;
-				put((const void*)((const char*)data + left), size - left);
+			size_t new_size = buffer.size + size;
+			if (new_size > buffer.buffer->buffer.size()) {
+				if (new_size > 2 + max_message_size) error("message_t: too much data :(");
+				message_buffer_handle new_buffer(server, server.acquire_send_buffer(new_size));
+				memcpy(new_buffer.buffer->buffer.data(), buffer.buffer->buffer.data(), buffer.size);
+				new_buffer.size = buffer.size;
+				buffer = std::move(new_buffer);
 			}
+			memcpy(buffer.buffer->buffer.data() + buffer.size, data, size);
+			buffer.size = new_size;
 		}
 	};
-	
+
 	message_t new_message() {
-		message_t r{*this};
-		auto buffer = get_send_buffer_with_space(0x10);
-		r.buffers.emplace_back(*this, buffer);
-		r.buffers.back().offset = buffer->pos;
+		message_t r{*this, {*this, acquire_send_buffer(0x10)}};
 		r.template put<uint16_t>(0);
 		return r;
 	}
-	
+
+	static const size_t max_send_buffers_per_write = 32;
+
 	void write_handler(client_t* c, const asio::error_code& ec, size_t bytes_transferred) {
 		if (ec) {
+			// Nothing more will be written to this client.
+			c->send_queue.clear();
 			if (c->on_kill) c->on_kill();
 		} else {
-			auto& v = c->send_queue.front();
-			if (bytes_transferred > v.size) error("write_handler: bytes_transferred > v.size");
-			v.offset += bytes_transferred;
-			v.size -= bytes_transferred;
-			if (v.size == 0) c->send_queue.pop_front();
+			while (bytes_transferred) {
+				if (c->send_queue.empty()) error("write_handler: bytes_transferred exceeds queued data");
+				auto& v = c->send_queue.front();
+				if (bytes_transferred >= v.size) {
+					bytes_transferred -= v.size;
+					c->send_queue.pop_front();
+				} else {
+					v.offset += bytes_transferred;
+					v.size -= bytes_transferred;
+					bytes_transferred = 0;
+				}
+			}
 			if (!c->send_queue.empty()) send_send_queue(c);
 		}
 	}
-	
+
 	void send_send_queue(client_t* client) {
-		auto& v = client->send_queue.front();
-		client->socket.async_write_some(asio::buffer(v.buffer->buffer.data() + v.offset, v.size), std::bind(&sync_server_asio_socket::write_handler, this, async_handle(client, std::bind(&sync_server_asio_socket::async_release, this, std::placeholders::_1)), std::placeholders::_1, std::placeholders::_2));
+		static_vector<asio::const_buffer, max_send_buffers_per_write> buffers;
+		for (auto& v : client->send_queue) {
+			buffers.push_back(asio::buffer(v.data(), v.size));
+			if (buffers.size() == buffers.max_size()) break;
+		}
+		client->socket.async_write_some(buffers, std::bind(&sync_server_asio_socket::write_handler, this, async_handle(client, std::bind(&sync_server_asio_socket::async_release, this, std::placeholders::_1)), std::placeholders::_1, std::placeholders::_2));
 	}
-	
+
 	void send_to(const message_t& d, client_t* client) {
 		if (!client->allow_send) return;
-		for (auto& v : d.buffers) {
-			client->send_queue.push_back(v);
-			if (client->send_queue.size() == 1) {
-				send_send_queue(client);
-			}
+		client->send_queue.push_back(d.buffer);
+		if (client->send_queue.size() == 1) {
+			send_send_queue(client);
 		}
 	}
 	
@@ -192,7 +233,7 @@ struct sync_server_asio_socket {
 	}
 	
 	void send_message(const message_t& d, const void* h) {
-		data_loading::set_value_at<true>(d.buffers[0].buffer->buffer.data() + d.buffers[0].offset, (uint16_t)(d.total_size - 2));
+		data_loading::set_value_at<true>(d.buffer.buffer->buffer.data(), (uint16_t)(d.buffer.size - 2));
 		if (h) {
 			send_to(d, (client_t*)h);
 		} else {
@@ -0,0 +1,370 @@
+#ifndef BWGAME_SYNC_SERVER_ASIO_THREADED_H
+#define BWGAME_SYNC_SERVER_ASIO_THREADED_H
+
+#include "sync_server_asio_socket.h"
+#include "spsc_queue.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace bwgame {
+
+// Runs one of the asio sync servers (sync_server_asio_tcp, sync_server_asio_local,
+// ...) on a dedicated I/O thread. Socket reads, message framing and writes all
+// happen on that thread, and fully framed messages are handed to and from the
+// simulation thread through a pair of spsc_queues, so network activity never
+// runs inside next_frame. It has the same interface as the wrapped server as
+// far as sync_functions is concerned.
+//
+// server may be used directly (bind, connect, ...) until start is called.
+// After that it belongs to the I/O thread and must only be accessed through post.
+template<typename server_T>
+struct sync_server_asio_threaded {
+
+	server_T server;
+
+	struct message_t {
+		a_vector<uint8_t> data;
+		template<typename T>
+		void put(T v) {
+			size_t n = data.size();
+			data.resize(n + sizeof(T));
+			data_loading::set_value_at<true>(data.data() + n, v);
+		}
+		void put(const void* src, size_t size) {
+			data.insert(data.end(), (const uint8_t*)src, (const uint8_t*)src + size);
+		}
+	};
+
+	enum {
+		command_send,
+		command_allow_send,
+		command_kill_client,
+		command_start_reading
+	};
+	struct command_t {
+		int type = command_send;
+		const void* h = nullptr;
+		bool allow = false;
+		a_vector<uint8_t> data;
+	};
+
+	enum {
+		event_new_client,
+		event_message,
+		event_kill,
+		event_error
+	};
+	struct event_t {
+		int type = event_new_client;
+		const void* h = nullptr;
+		a_vector<uint8_t> data;
+	};
+
+	struct client_t {
+		std::function<void()> on_kill;
+		std::function<void(const void*, size_t)> on_message;
+	};
+
+	spsc_queue<command_t> commands;
+	spsc_queue<event_t> events;
+
+	std::atomic<bool> drain_posted{false};
+	std::atomic<bool> sim_waiting{false};
+	std::mutex wait_mutex;
+	std::condition_variable wait_cv;
+
+	std::thread io_thread;
+	bool io_stopping = false;
+
+	// How long stop waits for queued messages to be written.
+	std::chrono::milliseconds stop_send_timeout{5000};
+	asio::steady_timer stop_timer{server.io_service};
+	bool stop_timed_out = false;
+
+	a_unordered_map<const void*, client_t> clients;
+	a_vector<const void*> killed_clients;
+
+	std::chrono::steady_clock::time_point timeout_time;
+	std::function<void()> timeout_function;
+
+	sync_server_asio_threaded() = default;
+	sync_server_asio_threaded(const sync_server_asio_threaded&) = delete;
+	sync_server_asio_threaded& operator=(const sync_server_asio_threaded&) = delete;
+	~sync_server_asio_threaded() {
+		stop();
+	}
+
+	void start() {
+		if (io_thread.joinable()) error("sync_server_asio_threaded: already started");
+		io_stopping = false;
+		io_thread = std::thread([this]() {
+			io_run();
+		});
+	}
+
+	// Sends any queued messages and then stops the I/O thread. A client that
+	// has not taken its messages within stop_send_timeout keeps the rest in
+	// its queue. Connections are left open; start may be called again to
+	// resume.
+	void stop() {
+		if (!io_thread.joinable()) return;
+		server.io_service.post([this]() {
+			io_drain_commands();
+			io_stopping = true;
+		});
+		io_thread.join();
+	}
+
+	template<typename F>
+	void post(F&& f) {
+		server.io_service.post(std::forward<F>(f));
+	}
+
+	// I/O thread.
+
+	void io_push_event(event_t&& e) {
+		events.push(std::move(e));
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (sim_waiting.load(std::memory_order_relaxed)) {
+			std::lock_guard<std::mutex> l(wait_mutex);
+			wait_cv.notify_one();
+		}
+	}
+
+	void io_new_client(const void* h) {
+		server.allow_send(h, false);
+		server.set_on_kill(h, [this, h]() {
+			event_t e;
+			e.type = event_kill;
+			e.h = h;
+			io_push_event(std::move(e));
+		});
+		event_t e;
+		e.type = event_new_client;
+		e.h = h;
+		io_push_event(std::move(e));
+	}
+
+	void io_drain_commands() {
+		drain_posted.store(false);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		command_t c;
+		while (commands.pop(c)) {
+			switch (c.type) {
+			case command_send: {
+				auto m = server.new_message();
+				if (!c.data.empty()) m.put(c.data.data(), c.data.size());
+				server.send_message(m, c.h);
+				break;
+			}
+			case command_allow_send:
+				server.allow_send(c.h, c.allow);
+				break;
+			case command_kill_client:
+				server.kill_client(c.h);
+				break;
+			case command_start_reading: {
+				const void* h = c.h;
+				server.set_on_message(h, [this, h](const void* data, size_t size) {
+					event_t e;
+					e.type = event_message;
+					e.h = h;
+					e.data.assign((const uint8_t*)data, (const uint8_t*)data + size);
+					io_push_event(std::move(e));
+				});
+				break;
+			}
+			}
+		}
+	}
+
+	bool io_sends_pending() {
+		for (auto& c : server.clients) {
+			if (!c.send_queue.empty()) return true;
+		}
+		return false;
+	}
+
+	void io_run() {
+		auto on_new_client = [this](const void* h) {
+			io_new_client(h);
+		};
+		try {
+			while (!io_stopping) {
+				server.run_one(on_new_client);
+			}
+			stop_timed_out = false;
+			stop_timer.expires_from_now(stop_send_timeout);
+			stop_timer.async_wait([this](const asio::error_code& ec) {
+				if (!ec) stop_timed_out = true;
+			});
+			while (!stop_timed_out && io_sends_pending()) {
+				server.run_one(on_new_client);
+			}
+			stop_timer.cancel();
+		} catch (const std::exception& ex) {
+			event_t e;
+			e.type = event_error;
+			const char* what = ex.what();
+			e.data.assign((const uint8_t*)what, (const uint8_t*)what + strlen(what));
+			io_push_event(std::move(e));
+		}
+	}
+
+	// Simulation thread.
+
+	void push_command(command_t&& c) {
+		commands.push(std::move(c));
+		if (!drain_posted.exchange(true)) {
+			server.io_service.post([this]() {
+				io_drain_commands();
+			});
+		}
+	}
+
+	message_t new_message() {
+		return {};
+	}
+
+	void send_message(const message_t& d, const void* h) {
+		command_t c;
+		c.type = command_send;
+		c.h = h;
+		c.data = d.data;
+		push_command(std::move(c));
+	}
+
+	void allow_send(const void* h, bool allow) {
+		command_t c;
+		c.type = command_allow_send;
+		c.h = h;
+		c.allow = allow;
+		push_command(std::move(c));
+	}
+
+	void kill_client(const void* h) {
+		// The callbacks may be running right now, so the entry is only
+		// removed once the current event has been dispatched.
+		killed_clients.push_back(h);
+		command_t c;
+		c.type = command_kill_client;
+		c.h = h;
+		push_command(std::move(c));
+	}
+
+	template<typename F>
+	void set_on_kill(const void* h, F&& f) {
+		auto i = clients.find(h);
+		if (i == clients.end()) return;
+		i->second.on_kill = std::forward<F>(f);
+	}
+
+	template<typename F>
+	void set_on_message(const void* h, F&& f) {
+		auto i = clients.find(h);
+		if (i == clients.end()) return;
+		bool start_reading = !i->second.on_message;
+		i->second.on_message = std::forward<F>(f);
+		if (start_reading) {
+			command_t c;
+			c.type = command_start_reading;
+			c.h = h;
+			push_command(std::move(c));
+		}
+	}
+
+	template<typename duration_T, typename callback_F>
+	void set_timeout(duration_T&& duration, callback_F&& callback) {
+		timeout_time = std::chrono::steady_clock::now() + duration;
+		timeout_function = std::forward<callback_F>(callback);
+	}
+
+	void remove_killed_clients() {
+		for (const void* h : killed_clients) clients.erase(h);
+		killed_clients.clear();
+	}
+
+	template<typename on_new_client_F>
+	bool process_events(on_new_client_F& on_new_client) {
+		remove_killed_clients();
+		bool any = false;
+		event_t e;
+		while (events.pop(e)) {
+			any = true;
+			switch (e.type) {
+			case event_new_client:
+				clients.emplace(e.h, client_t());
+				allow_send(e.h, true);
+				on_new_client(e.h);
+				break;
+			case event_message: {
+				auto i = clients.find(e.h);
+				if (i != clients.end() && i->second.on_message) i->second.on_message(e.data.data(), e.data.size());
+				break;
+			}
+			case event_kill: {
+				auto i = clients.find(e.h);
+				if (i != clients.end() && i->second.on_kill) i->second.on_kill();
+				break;
+			}
+			case event_error:
+				error("sync_server_asio_threaded: I/O thread failed: %s", a_string(e.data.begin(), e.data.end()));
+			}
+			remove_killed_clients();
+		}
+		return any;
+	}
+
+	bool run_timeout() {
+		if (!timeout_function || std::chrono::steady_clock::now() < timeout_time) return false;
+		auto f = std::move(timeout_function);
+		timeout_function = nullptr;
+		f();
+		return true;
+	}
+
+	void wait_for_events() {
+		std::unique_lock<std::mutex> l(wait_mutex);
+		sim_waiting.store(true, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (events.empty()) {
+			if (timeout_function) wait_cv.wait_until(l, timeout_time);
+			else wait_cv.wait(l);
+		}
+		sim_waiting.store(false, std::memory_order_relaxed);
+	}
+
+	template<typename on_new_client_F>
+	void poll(on_new_client_F&& on_new_client) {
+		process_events(on_new_client);
+		run_timeout();
+	}
+
+	template<typename on_new_client_F>
+	void run_one(on_new_client_F&& on_new_client) {
+		if (!io_thread.joinable()) error("sync_server_asio_threaded: not started");
+		while (true) {
+			if (process_events(on_new_client)) return;
+			if (run_timeout()) return;
+			wait_for_events();
+		}
+	}
+
+	template<typename on_new_client_F, typename pred_F>
+	void run_until(on_new_client_F&& on_new_client, pred_F&& pred) {
+		while (!pred()) {
+			run_one(on_new_client);
+		}
+	}
+};
+
+}
+
+#endif
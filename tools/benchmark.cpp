@@ -0,0 +1,211 @@
+// Simulation benchmark over a fixed replay corpus.
+//
+//   benchmark [options] <data dir> <corpus dir>
+//
+//   --update                     rewrite the expected hashes in the manifest
+//   --trace <file>               write a Chrome trace of the whole run
+//                                (benchmark_profiled only)
+//   --unit-finder-bucket-size N  rebucket the unit finder after loading (a
+//                                huge value gives the old single sorted vector)
+//   --only <category>            only run replays of this category
+//
+// The corpus directory contains a manifest, benchmark.txt, with one replay
+// per line (see benchmark_manifest.h):
+//
+//   # category  replay (relative to the corpus dir)  expected final state hash
+//   1v1         ladder/fighting_spirit_tvz.rep        8f3a0c1e5b2d4a96
+//   4v4         team/bgh_4v4.rep                      -
+//   ums         ums/big_game_hunters_1700.rep         -
+//
+// The corpus is expected to cover 1v1 ladder games, 4v4 games and
+// high-unit-count UMS maps. Each replay is simulated single threaded to its
+// end frame; the hash of the final state must match the manifest, so any
+// change that desyncs the simulation fails the run.
+//
+// The "max rss" column is the peak resident set size of the whole process
+// so far, as reported by getrusage, so it never goes down from one replay
+// to the next. It shows which replay first pushed memory use higher; use
+// --only to measure a category on its own.
+//
+// benchmark is built without the profiler so that its timings are not
+// skewed by it. benchmark_profiled is the same tool built with
+// OPENBW_ENABLE_PROFILER; it prints a per-zone summary after the results
+// and can write a trace.
+
+#include "bwgame.h"
+#include "actions.h"
+#include "replay.h"
+#include "benchmark_manifest.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+
+#include <sys/resource.h>
+
+using namespace bwgame;
+
+namespace {
+
+struct benchmark_result {
+	int frames = 0;
+	double seconds = 0.0;
+	a_string hash;
+	long max_rss_so_far_kb = 0;
+};
+
+// Peak resident set size of the process since it started.
+long max_rss_so_far_kb() {
+	rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+	return usage.ru_maxrss;
+}
+
+benchmark_result run_replay(const global_state& global_st, const a_string& filename, int unit_finder_bucket_size) {
+	auto game_st = std::make_unique<game_state>();
+	auto st = std::make_unique<state>();
+	st->global = &global_st;
+	st->game = game_st.get();
+	action_state action_st;
+	replay_state replay_st;
+	replay_functions funcs(*st, action_st, replay_st);
+
+	funcs.load_replay_file(filename);
+	if (unit_finder_bucket_size) {
+		st->unit_finder_x.rebucket(game_st->map_width, unit_finder_bucket_size);
+		st->unit_finder_y.rebucket(game_st->map_height, unit_finder_bucket_size);
+	}
+
+	benchmark_result r;
+	auto start = std::chrono::steady_clock::now();
+	while (st->current_frame != replay_st.end_frame) funcs.next_frame();
+	r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	r.frames = st->current_frame;
+	r.hash = format("%016llx", (unsigned long long)state_hash(*st));
+	r.max_rss_so_far_kb = max_rss_so_far_kb();
+	return r;
+}
+
+void usage() {
+	fprintf(stderr, "usage: benchmark [--update] [--trace file] [--unit-finder-bucket-size n] [--only category] <data dir> <corpus dir>\n");
+}
+
+}
+
+int main(int argc, char** argv) {
+	bool update = false;
+	a_string trace_filename;
+	a_string only_category;
+	int unit_finder_bucket_size = 0;
+	a_vector<a_string> args;
+	for (int i = 1; i < argc; ++i) {
+		a_string arg = argv[i];
+		auto value = [&]() {
+			if (i + 1 == argc) {
+				usage();
+				exit(1);
+			}
+			return a_string(argv[++i]);
+		};
+		if (arg == "--update") update = true;
+		else if (arg == "--trace") {
+			trace_filename = value();
+#ifndef OPENBW_ENABLE_PROFILER
+			fprintf(stderr, "--trace requires benchmark_profiled\n");
+			return 1;
+#endif
+		}
+		else if (arg == "--only") only_category = value();
+		else if (arg == "--unit-finder-bucket-size") unit_finder_bucket_size = std::atoi(value().c_str());
+		else args.push_back(arg);
+	}
+	if (args.size() != 2) {
+		usage();
+		return 1;
+	}
+	a_string data_path = args[0];
+	a_string corpus_path = args[1];
+	if (!corpus_path.empty() && corpus_path.back() != '/') corpus_path += '/';
+	a_string manifest_filename = corpus_path + "benchmark.txt";
+
+	a_vector<benchmark_entry> entries;
+	auto global_st = std::make_unique<global_state>();
+	try {
+		entries = read_manifest(manifest_filename);
+		global_init(*global_st, data_loading::data_files_directory(data_path));
+	} catch (const std::exception& e) {
+		fprintf(stderr, "error: %s\n", e.what());
+		return 1;
+	}
+
+#ifdef OPENBW_ENABLE_PROFILER
+	profiler::frame_profiler prof;
+	prof.record_trace = !trace_filename.empty();
+	profiler::install(&prof);
+#endif
+
+	struct category_totals {
+		int replays = 0;
+		int64_t frames = 0;
+		double seconds = 0.0;
+	};
+	std::map<a_string, category_totals> totals;
+	int mismatches = 0;
+	int failures = 0;
+
+	printf("%-8s %-40s %8s %9s %10s %10s %-16s %s\n", "category", "replay", "frames", "seconds", "frames/s", "max rss", "hash", "result");
+	for (auto& v : entries) {
+		if (!only_category.empty() && v.category != only_category) continue;
+		benchmark_result r;
+		try {
+			r = run_replay(*global_st, corpus_path + v.filename, unit_finder_bucket_size);
+		} catch (const std::exception& e) {
+			++failures;
+			printf("%-8s %-40s error: %s\n", v.category.c_str(), v.filename.c_str(), e.what());
+			continue;
+		}
+		const char* result = "ok";
+		if (update) {
+			if (v.expected_hash != r.hash) result = "updated";
+			v.expected_hash = r.hash;
+		} else if (v.expected_hash == "-") {
+			result = "no hash";
+		} else if (v.expected_hash != r.hash) {
+			result = "MISMATCH";
+			++mismatches;
+		}
+		printf("%-8s %-40s %8d %9.3f %10.0f %8ldMB %-16s %s\n", v.category.c_str(), v.filename.c_str(), r.frames, r.seconds,
+			r.frames / r.seconds, r.max_rss_so_far_kb / 1024, r.hash.c_str(), result);
+		fflush(stdout);
+		auto& t = totals[v.category];
+		++t.replays;
+		t.frames += r.frames;
+		t.seconds += r.seconds;
+	}
+
+	printf("\n%-8s %8s %10s %9s %10s\n", "category", "replays", "frames", "seconds", "frames/s");
+	for (auto& v : totals) {
+		printf("%-8s %8d %10lld %9.3f %10.0f\n", v.first.c_str(), v.second.replays, (long long)v.second.frames, v.second.seconds, v.second.frames / v.second.seconds);
+	}
+#ifdef OPENBW_ENABLE_PROFILER
+	printf("\n");
+	prof.print_summary(stdout);
+
+	if (!trace_filename.empty() && !prof.write_chrome_trace(trace_filename.c_str())) {
+		fprintf(stderr, "error: failed to write %s\n", trace_filename.c_str());
+	}
+#endif
+	if (update) {
+		try {
+			write_manifest(manifest_filename, entries);
+		} catch (const std::exception& e) {
+			fprintf(stderr, "error: %s\n", e.what());
+			return 1;
+		}
+	}
+
+	if (mismatches) fprintf(stderr, "%d replay(s) did not match the expected final state hash\n", mismatches);
+	return mismatches || failures ? 2 : 0;
+}
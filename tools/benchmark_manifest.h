@@ -0,0 +1,56 @@
+#ifndef BWGAME_TOOLS_BENCHMARK_MANIFEST_H
+#define BWGAME_TOOLS_BENCHMARK_MANIFEST_H
+
+// The benchmark.txt manifest of a benchmark corpus, shared by benchmark and
+// decode_benchmark. One replay per line:
+//
+//   # category  replay (relative to the corpus dir)  expected final state hash
+//   1v1         ladder/fighting_spirit_tvz.rep        8f3a0c1e5b2d4a96
+//   4v4         team/bgh_4v4.rep                      -
+//
+// A missing hash reads as "-".
+
+#include "util.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+namespace bwgame {
+
+struct benchmark_entry {
+	a_string category;
+	a_string filename;
+	a_string expected_hash;
+};
+
+static inline a_vector<benchmark_entry> read_manifest(const a_string& filename) {
+	std::ifstream f(filename.c_str());
+	if (!f) error("failed to open manifest %s", filename);
+	a_vector<benchmark_entry> r;
+	std::string line;
+	while (std::getline(f, line)) {
+		std::istringstream ss(line);
+		std::string category, replay, hash;
+		if (!(ss >> category) || category[0] == '#') continue;
+		if (!(ss >> replay)) error("%s: missing replay filename for category %s", filename, category.c_str());
+		if (!(ss >> hash)) hash = "-";
+		r.push_back({category.c_str(), replay.c_str(), hash.c_str()});
+	}
+	return r;
+}
+
+static inline void write_manifest(const a_string& filename, const a_vector<benchmark_entry>& entries) {
+	FILE* f = fopen(filename.c_str(), "wb");
+	if (!f) error("failed to open manifest %s for writing", filename);
+	fprintf(f, "# category  replay  expected final state hash\n");
+	for (auto& v : entries) {
+		fprintf(f, "%s %s %s\n", v.category.c_str(), v.filename.c_str(), v.expected_hash.c_str());
+	}
+	fclose(f);
+}
+
+}
+
+#endif
@@ -0,0 +1,120 @@
+// Army clash benchmark for unit movement and collision.
+//
+//   clash_benchmark [--units n] [--type unit id] [--frames n] [--trace file] <data dir> <map>
+//
+// Loads the map with no starting units, creates n units (200 zerglings by
+// default) for each of players 0 and 1 on either side of the map center,
+// orders both armies to attack move through each other and simulates the
+// given number of frames. Prints the simulation rate and the profiler
+// summary, whose unit_collision and unit_finder_* zones cover the collision
+// checks done by moving ground units. The final state hash is printed so
+// that runs of two builds can be compared.
+
+#include "bwgame.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+using namespace bwgame;
+
+namespace {
+
+void usage() {
+	fprintf(stderr, "usage: clash_benchmark [--units n] [--type unit id] [--frames n] [--trace file] <data dir> <map>\n");
+}
+
+}
+
+int main(int argc, char** argv) {
+	int units_per_side = 200;
+	int unit_type_id = (int)UnitTypes::Zerg_Zergling;
+	int frames = 24 * 60;
+	a_string trace_filename;
+	a_vector<a_string> args;
+	for (int i = 1; i < argc; ++i) {
+		a_string arg = argv[i];
+		auto value = [&]() {
+			if (i + 1 == argc) {
+				usage();
+				exit(1);
+			}
+			return a_string(argv[++i]);
+		};
+		if (arg == "--units") units_per_side = std::atoi(value().c_str());
+		else if (arg == "--type") unit_type_id = std::atoi(value().c_str());
+		else if (arg == "--frames") frames = std::atoi(value().c_str());
+		else if (arg == "--trace") trace_filename = value();
+		else args.push_back(arg);
+	}
+	if (args.size() != 2 || units_per_side <= 0 || frames <= 0 || unit_type_id < 0 || unit_type_id >= 228) {
+		usage();
+		return 1;
+	}
+
+	auto global_st = std::make_unique<global_state>();
+	auto game_st = std::make_unique<game_state>();
+	auto st = std::make_unique<state>();
+	st->global = global_st.get();
+	st->game = game_st.get();
+	state_functions funcs(*st);
+
+	int created = 0;
+	try {
+		global_init(*global_st, data_loading::data_files_directory(args[0]));
+
+		game_load_functions game_load_funcs(*st);
+		game_load_funcs.setup_info.create_no_units = true;
+		game_load_funcs.load_map_file(args[1], [&]() {
+			for (int i = 0; i != 12; ++i) {
+				auto& p = st->players[i];
+				if (i < 2) {
+					p.controller = player_t::controller_occupied;
+					p.race = race_t::zerg;
+				} else if (p.controller == player_t::controller_open || p.controller == player_t::controller_computer) {
+					p.controller = player_t::controller_inactive;
+				}
+			}
+		});
+
+		const unit_type_t* unit_type = funcs.get_unit_type((UnitTypes)unit_type_id);
+		xy center(game_st->map_width / 2, game_st->map_height / 2);
+		int columns = 10;
+		int spacing = std::max(unit_type->dimensions.from.x + unit_type->dimensions.to.x, unit_type->dimensions.from.y + unit_type->dimensions.to.y) + 4;
+		a_vector<unit_t*> armies[2];
+		for (int side = 0; side != 2; ++side) {
+			int dir = side == 0 ? -1 : 1;
+			for (int n = 0; n != units_per_side; ++n) {
+				xy pos = center + xy(dir * (160 + (n % columns) * spacing), (n / columns - units_per_side / columns / 2) * spacing);
+				unit_t* u = funcs.trigger_create_unit(unit_type, pos, side);
+				if (u) armies[side].push_back(u);
+			}
+			created += (int)armies[side].size();
+		}
+		for (int side = 0; side != 2; ++side) {
+			xy target = center + xy(side == 0 ? 640 : -640, 0);
+			for (unit_t* u : armies[side]) funcs.set_unit_order(u, funcs.get_order_type(Orders::AttackMove), target);
+		}
+	} catch (const std::exception& e) {
+		fprintf(stderr, "error: %s\n", e.what());
+		return 1;
+	}
+
+	profiler::frame_profiler prof;
+	prof.record_trace = !trace_filename.empty();
+	profiler::install(&prof);
+
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i != frames; ++i) funcs.next_frame();
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	printf("%d units created, %d frames in %.3f seconds, %.0f frames/s, final state hash %016llx\n\n", created, frames, seconds, frames / seconds,
+		(unsigned long long)state_hash(*st));
+	prof.print_summary(stdout);
+
+	if (!trace_filename.empty() && !prof.write_chrome_trace(trace_filename.c_str())) {
+		fprintf(stderr, "error: failed to write %s\n", trace_filename.c_str());
+	}
+	return 0;
+}
@@ -0,0 +1,103 @@
+// Replay decoding micro-benchmark over the benchmark corpus.
+//
+//   decode_benchmark [-n iterations] <corpus dir>
+//
+// Reads the same benchmark.txt manifest as the simulation benchmark and, for
+// each replay, repeatedly decodes every section (crc check and implode
+// decompression) from memory without loading the map into a game. No data
+// files are needed.
+
+#include "replay.h"
+#include "benchmark_manifest.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace bwgame;
+
+namespace {
+
+// Decodes all sections of the replay and returns the number of decompressed
+// bytes.
+size_t decode_replay(const uint8_t* data, size_t data_size, a_vector<uint8_t>& buffer) {
+	auto base_r = data_loading::data_reader_le(data, data + data_size);
+	auto r = data_loading::make_replay_file_reader(base_r);
+	replay_header h = read_replay_header(r);
+	size_t total = 633;
+	if (h.identifier == replay_magic_tr) total += 0x1c;
+	for (int i = 0; i != 2; ++i) {
+		buffer.resize(r.get<uint32_t>());
+		r.get_bytes(buffer.data(), buffer.size());
+		total += buffer.size();
+	}
+	return total;
+}
+
+void usage() {
+	fprintf(stderr, "usage: decode_benchmark [-n iterations] <corpus dir>\n");
+}
+
+}
+
+int main(int argc, char** argv) {
+	int iterations = 20;
+	a_vector<a_string> args;
+	for (int i = 1; i < argc; ++i) {
+		a_string arg = argv[i];
+		if (arg == "-n") {
+			if (i + 1 == argc) {
+				usage();
+				return 1;
+			}
+			iterations = std::atoi(argv[++i]);
+		} else args.push_back(arg);
+	}
+	if (args.size() != 1 || iterations <= 0) {
+		usage();
+		return 1;
+	}
+	a_string corpus_path = args[0];
+	if (!corpus_path.empty() && corpus_path.back() != '/') corpus_path += '/';
+
+	a_vector<benchmark_entry> replays;
+	try {
+		replays = read_manifest(corpus_path + "benchmark.txt");
+	} catch (const std::exception& e) {
+		fprintf(stderr, "error: %s\n", e.what());
+		return 1;
+	}
+
+	int failures = 0;
+	size_t total_bytes = 0;
+	double total_seconds = 0.0;
+	a_vector<uint8_t> buffer;
+
+	printf("%-40s %10s %10s %9s %10s\n", "replay", "file size", "decoded", "seconds", "MB/s");
+	for (auto& v : replays) {
+		size_t bytes = 0;
+		double seconds = 0.0;
+		size_t file_size = 0;
+		try {
+			data_loading::mapped_file file(corpus_path + v.filename);
+			file_size = file.size();
+			auto start = std::chrono::steady_clock::now();
+			for (int i = 0; i != iterations; ++i) bytes += decode_replay(file.data(), file.size(), buffer);
+			seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		} catch (const std::exception& e) {
+			++failures;
+			printf("%-40s error: %s\n", v.filename.c_str(), e.what());
+			continue;
+		}
+		printf("%-40s %10zu %10zu %9.3f %10.1f\n", v.filename.c_str(), file_size, bytes / iterations, seconds, bytes / seconds / (1024 * 1024));
+		fflush(stdout);
+		total_bytes += bytes;
+		total_seconds += seconds;
+	}
+
+	if (total_seconds > 0.0) {
+		printf("\ntotal: %zu bytes decoded in %.3f seconds, %.1f MB/s\n", total_bytes, total_seconds, total_bytes / total_seconds / (1024 * 1024));
+	}
+
+	return failures ? 2 : 0;
+}
@@ -0,0 +1,208 @@
+// Finds the first frame and object where two builds of the simulation diverge
+// on the same replay.
+//
+//   desync_bisect compare <build a> <build b> <data dir> <replay>
+//
+// runs "<build> run <data dir> <replay>" for both builds side by side. Each
+// prints the state_hash of every frame; at the first frame where the hashes
+// differ both builds are run again with --dump-frame, which dumps every object
+// of the state field by field, and the first differing object and field are
+// reported. The build arguments are paths to desync_bisect executables built
+// from the two source trees being compared.
+//
+//   desync_bisect run <data dir> <replay> [--dump-frame <frame>]
+//
+// is the worker mode used by compare.
+
+#include "bwgame.h"
+#include "actions.h"
+#include "replay.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+#include <sys/wait.h>
+
+using namespace bwgame;
+
+namespace {
+
+struct dump_sink {
+	FILE* f;
+	const char* kind = nullptr;
+	size_t index = 0;
+	void begin_object(const char* kind, size_t index) {
+		this->kind = kind;
+		this->index = index;
+	}
+	void field(const char* name, uint64_t value) {
+		fprintf(f, "%s %zu %s %#" PRIx64 "\n", kind, index, name, value);
+	}
+	void end_object() {
+	}
+};
+
+int run(const a_string& data_path, const a_string& replay_filename, int dump_frame) {
+	auto global_st = std::make_unique<global_state>();
+	global_init(*global_st, data_loading::data_files_directory(data_path));
+	auto game_st = std::make_unique<game_state>();
+	auto st = std::make_unique<state>();
+	st->global = global_st.get();
+	st->game = game_st.get();
+	action_state action_st;
+	replay_state replay_st;
+	replay_functions funcs(*st, action_st, replay_st);
+
+	funcs.load_replay_file(replay_filename);
+	state_hasher hasher;
+	while (true) {
+		if (st->current_frame == dump_frame) {
+			dump_sink sink{stdout};
+			state_hash_visitor<dump_sink> visitor(*st, sink);
+			visitor.visit();
+			return 0;
+		}
+		if (dump_frame == -1) {
+			hasher.compute(*st);
+			printf("%d %016" PRIx64 "\n", st->current_frame, hasher.hash);
+		}
+		if (funcs.is_done()) break;
+		funcs.next_frame();
+	}
+	if (dump_frame != -1) error("replay ended before frame %d", dump_frame);
+	return 0;
+}
+
+struct process {
+	a_string name;
+	FILE* f = nullptr;
+	process(a_string name, const a_string& command) : name(std::move(name)) {
+		f = popen(command.c_str(), "r");
+		if (!f) error("failed to run %s", command);
+	}
+	~process() {
+		if (f) pclose(f);
+	}
+	// Waits for the process to exit; fails if it did not exit successfully.
+	// Only meaningful once all of its output has been read, since a process
+	// that is closed early may be killed by SIGPIPE.
+	void finish() {
+		int status = pclose(f);
+		f = nullptr;
+		if (status == -1) error("%s: failed to get exit status", name);
+		if (WIFSIGNALED(status)) error("%s was killed by signal %d", name, WTERMSIG(status));
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) error("%s failed with exit status %d", name, WEXITSTATUS(status));
+	}
+	bool read_line(a_string& line) {
+		line.clear();
+		int c;
+		while ((c = fgetc(f)) != EOF) {
+			if (c == '\n') return true;
+			line += (char)c;
+		}
+		return !line.empty();
+	}
+};
+
+a_string quote(const a_string& str) {
+	a_string r = "'";
+	for (char c : str) {
+		if (c == '\'') r += "'\\''";
+		else r += c;
+	}
+	r += "'";
+	return r;
+}
+
+int compare(const a_string& build_a, const a_string& build_b, const a_string& data_path, const a_string& replay_filename) {
+	auto command = [&](const a_string& build, const a_string& extra) {
+		return quote(build) + " run " + quote(data_path) + " " + quote(replay_filename) + extra;
+	};
+	int diverged_frame = -1;
+	{
+		process a("build a", command(build_a, ""));
+		process b("build b", command(build_b, ""));
+		a_string line_a;
+		a_string line_b;
+		while (true) {
+			bool has_a = a.read_line(line_a);
+			bool has_b = b.read_line(line_b);
+			if (!has_a && !has_b) {
+				a.finish();
+				b.finish();
+				break;
+			}
+			if (has_a != has_b) {
+				(has_a ? b : a).finish();
+				printf("%s stopped early\n", has_a ? "build b" : "build a");
+				if (has_a) diverged_frame = std::atoi(line_a.c_str());
+				else diverged_frame = std::atoi(line_b.c_str());
+				break;
+			}
+			if (line_a != line_b) {
+				diverged_frame = std::atoi(line_a.c_str());
+				printf("state hashes diverge at frame %d\n  a: %s\n  b: %s\n", diverged_frame, line_a.c_str(), line_b.c_str());
+				break;
+			}
+		}
+	}
+	if (diverged_frame == -1) {
+		printf("no divergence\n");
+		return 0;
+	}
+
+	a_string extra = format(" --dump-frame %d", diverged_frame);
+	process a("build a", command(build_a, extra));
+	process b("build b", command(build_b, extra));
+	a_string line_a;
+	a_string line_b;
+	while (true) {
+		bool has_a = a.read_line(line_a);
+		bool has_b = b.read_line(line_b);
+		if (!has_a && !has_b) {
+			a.finish();
+			b.finish();
+			break;
+		}
+		if (!has_a) a.finish();
+		if (!has_b) b.finish();
+		if (line_a != line_b || has_a != has_b) {
+			printf("first difference at frame %d\n  a: %s\n  b: %s\n", diverged_frame, has_a ? line_a.c_str() : "(end)", has_b ? line_b.c_str() : "(end)");
+			return 1;
+		}
+	}
+	printf("frame %d hashes differ but the dumps are identical\n", diverged_frame);
+	return 1;
+}
+
+void usage() {
+	fprintf(stderr, "usage: desync_bisect compare <build a> <build b> <data dir> <replay>\n");
+	fprintf(stderr, "       desync_bisect run <data dir> <replay> [--dump-frame <frame>]\n");
+}
+
+}
+
+int main(int argc, char** argv) {
+	try {
+		if (argc >= 4 && !strcmp(argv[1], "run")) {
+			int dump_frame = -1;
+			if (argc == 6 && !strcmp(argv[4], "--dump-frame")) dump_frame = std::atoi(argv[5]);
+			else if (argc != 4) {
+				usage();
+				return 1;
+			}
+			return run(argv[2], argv[3], dump_frame);
+		}
+		if (argc == 6 && !strcmp(argv[1], "compare")) {
+			return compare(argv[2], argv[3], argv[4], argv[5]);
+		}
+	} catch (const std::exception& e) {
+		fprintf(stderr, "error: %s\n", e.what());
+		return 2;
+	}
+	usage();
+	return 1;
+}
@@ -0,0 +1,272 @@
+// Headless batch runner: simulates many replays in parallel and prints one
+// JSON object per replay to stdout.
+//
+//   replay_runner [-j threads] [--data-cache file] <data dir> <replay|directory|@listfile>...
+//   replay_runner --header-only [-j threads] <replay|directory|@listfile>...
+//
+// --data-cache keeps the decompressed data files in the given file (see
+// data_loading::data_files_cache), so later runs start without decompressing
+// the mpq archives. --header-only only prints the metadata in the replay
+// headers and needs no data files.
+//
+// The global_state (the .dat/.mpq data) is loaded once and shared read-only
+// between all workers; every worker owns its own game_state, state,
+// action_state and replay_state, so nothing mutable is shared between
+// threads.
+
+#include "bwgame.h"
+#include "actions.h"
+#include "replay.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+using namespace bwgame;
+
+namespace {
+
+a_string json_string(const a_string& str) {
+	a_string r = "\"";
+	for (char c : str) {
+		if (c == '"') r += "\\\"";
+		else if (c == '\\') r += "\\\\";
+		else if ((unsigned char)c < 0x20) r += format("\\u%04x", (int)(unsigned char)c);
+		else r += c;
+	}
+	r += '"';
+	return r;
+}
+
+const char* race_name(race_t race) {
+	switch (race) {
+	case race_t::zerg: return "zerg";
+	case race_t::terran: return "terran";
+	case race_t::protoss: return "protoss";
+	default: return "none";
+	}
+}
+
+bool is_directory(const a_string& path) {
+	struct stat s;
+	if (stat(path.c_str(), &s) != 0) return false;
+	return S_ISDIR(s.st_mode);
+}
+
+bool has_replay_extension(const a_string& filename) {
+	if (filename.size() < 4) return false;
+	a_string ext = filename.substr(filename.size() - 4);
+	for (auto& c : ext) c = (char)std::tolower((unsigned char)c);
+	return ext == ".rep";
+}
+
+void add_directory(a_vector<a_string>& files, a_string path) {
+	DIR* dir = opendir(path.c_str());
+	if (!dir) error("failed to open directory %s", path);
+	if (path[path.size() - 1] != '/') path += '/';
+	a_vector<a_string> entries;
+	while (dirent* e = readdir(dir)) {
+		a_string name = e->d_name;
+		if (name == "." || name == "..") continue;
+		entries.push_back(path + name);
+	}
+	closedir(dir);
+	std::sort(entries.begin(), entries.end());
+	for (auto& v : entries) {
+		if (is_directory(v)) add_directory(files, v);
+		else if (has_replay_extension(v)) files.push_back(v);
+	}
+}
+
+void add_list_file(a_vector<a_string>& files, const a_string& filename) {
+	std::ifstream f(filename.c_str());
+	if (!f) error("failed to open list file %s", filename);
+	std::string line;
+	while (std::getline(f, line)) {
+		while (!line.empty() && (line.back() == '\r' || line.back() == ' ')) line.pop_back();
+		if (line.empty() || line[0] == '#') continue;
+		files.push_back(a_string(line.c_str()));
+	}
+}
+
+a_string run_replay(const global_state& global_st, const a_string& filename) {
+	auto game_st = std::make_unique<game_state>();
+	auto st = std::make_unique<state>();
+	st->global = &global_st;
+	st->game = game_st.get();
+	action_state action_st;
+	replay_state replay_st;
+	replay_functions funcs(*st, action_st, replay_st);
+
+	auto start = std::chrono::steady_clock::now();
+	funcs.load_replay_file(filename);
+	while (!funcs.is_done()) funcs.next_frame();
+	auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+
+	// A replay does not record its result, so the players still standing are
+	// only reported as winners if somebody was eliminated or left.
+	bool any_defeated = false;
+	for (int i = 0; i != 8; ++i) {
+		if (st->players[i].initially_active && funcs.player_defeated(i)) any_defeated = true;
+	}
+
+	a_string players;
+	a_string winners;
+	for (int i = 0; i != 8; ++i) {
+		auto& p = st->players[i];
+		if (!p.initially_active) continue;
+		bool won = funcs.player_won(i) || (any_defeated && !funcs.player_defeated(i));
+		if (won) {
+			if (!winners.empty()) winners += ",";
+			winners += std::to_string(i);
+		}
+		if (!players.empty()) players += ",";
+		players += format("{\"slot\":%d,\"name\":%s,\"race\":\"%s\",\"victory_state\":%d,\"left\":%s,\"minerals_gathered\":%d,\"gas_gathered\":%d,\"unit_score\":%d,\"building_score\":%d}",
+			i, json_string(replay_st.player_name[i]), race_name(p.race), p.victory_state, p.controller == player_t::controller_user_left ? "true" : "false",
+			st->total_minerals_gathered[i], st->total_gas_gathered[i], st->unit_score[i], st->building_score[i]);
+	}
+
+	return format("{\"file\":%s,\"map\":%s,\"frames\":%d,\"ms\":%d,\"winners\":[%s],\"players\":[%s]}",
+		json_string(filename), json_string(replay_st.map_name), st->current_frame, (int)ms, winners, players);
+}
+
+a_string run_replay_header(const a_string& filename) {
+	data_loading::mapped_file file(filename);
+	replay_header h = read_replay_header_data(file.data(), file.size());
+
+	a_string players;
+	for (int i = 0; i != 12; ++i) {
+		if (h.player_name[i].empty()) continue;
+		if (!players.empty()) players += ",";
+		players += format("{\"slot\":%d,\"name\":%s,\"race\":\"%s\",\"controller\":%d,\"force\":%d}",
+			i, json_string(h.player_name[i]), race_name((race_t)h.slot_race[i]), h.slot_controller[i], h.slot_force[i]);
+	}
+
+	return format("{\"file\":%s,\"map\":%s,\"map_width\":%d,\"map_height\":%d,\"frames\":%d,\"game_type\":%d,\"players\":[%s]}",
+		json_string(filename), json_string(h.map_name), h.map_width, h.map_height, h.frame_count, h.game_type, players);
+}
+
+void usage() {
+	fprintf(stderr, "usage: replay_runner [-j threads] [--data-cache file] <data dir> <replay|directory|@listfile>...\n");
+	fprintf(stderr, "       replay_runner --header-only [-j threads] <replay|directory|@listfile>...\n");
+}
+
+}
+
+int main(int argc, char** argv) {
+	size_t threads = std::thread::hardware_concurrency();
+	a_string data_path;
+	a_vector<a_string> files;
+	bool header_only = false;
+	a_string data_cache_filename;
+
+	a_vector<a_string> args;
+	for (int i = 1; i < argc; ++i) {
+		a_string arg = argv[i];
+		if (arg == "-j") {
+			if (i + 1 == argc) {
+				usage();
+				return 1;
+			}
+			threads = (size_t)std::atoi(argv[++i]);
+		} else if (arg == "--data-cache") {
+			if (i + 1 == argc) {
+				usage();
+				return 1;
+			}
+			data_cache_filename = argv[++i];
+		} else if (arg == "--header-only") {
+			header_only = true;
+		} else {
+			args.push_back(arg);
+		}
+	}
+	// Flags may appear anywhere, so positionals are only assigned once
+	// --header-only is known.
+	try {
+		for (auto& arg : args) {
+			if (data_path.empty() && !header_only) {
+				data_path = arg;
+			} else if (arg[0] == '@') {
+				add_list_file(files, arg.substr(1));
+			} else if (is_directory(arg)) {
+				add_directory(files, arg);
+			} else {
+				files.push_back(arg);
+			}
+		}
+	} catch (const exception& e) {
+		fprintf(stderr, "error: %s\n", e.what());
+		return 1;
+	}
+	if ((data_path.empty() && !header_only) || files.empty()) {
+		usage();
+		return 1;
+	}
+	if (threads == 0) threads = 1;
+	// The data files are loaded before any replay is started, so they can use
+	// every thread no matter how few replays there are.
+	size_t decode_threads = threads;
+	if (threads > files.size()) threads = files.size();
+
+	auto global_st = std::make_unique<global_state>();
+	if (!header_only) {
+		try {
+			if (data_cache_filename.empty()) {
+				auto loader = data_loading::data_files_directory(data_path);
+				loader.set_decode_threads(decode_threads);
+				global_init(*global_st, loader);
+			} else {
+				data_loading::data_files_cache<> cache(data_path, data_cache_filename);
+				cache.decode_threads = decode_threads;
+				global_init(*global_st, cache);
+				cache.save();
+			}
+		} catch (const std::exception& e) {
+			fprintf(stderr, "error: failed to load data files: %s\n", e.what());
+			return 1;
+		}
+	}
+
+	std::atomic<size_t> next_index{0};
+	std::atomic<size_t> failed{0};
+	std::mutex output_mut;
+	auto output = [&](const a_string& line) {
+		std::lock_guard<std::mutex> l(output_mut);
+		fprintf(stdout, "%s\n", line.c_str());
+		fflush(stdout);
+	};
+
+	auto worker = [&]() {
+		while (true) {
+			size_t index = next_index++;
+			if (index >= files.size()) break;
+			const a_string& filename = files[index];
+			a_string line;
+			try {
+				line = header_only ? run_replay_header(filename) : run_replay(*global_st, filename);
+			} catch (const std::exception& e) {
+				++failed;
+				line = format("{\"file\":%s,\"error\":%s}", json_string(filename), json_string(e.what()));
+			}
+			output(line);
+		}
+	};
+
+	a_vector<std::thread> workers;
+	for (size_t i = 1; i < threads; ++i) workers.emplace_back(worker);
+	worker();
+	for (auto& v : workers) v.join();
+
+	return failed ? 2 : 0;
+}
@@ -63,7 +63,7 @@ namespace bwgame
 
 struct saved_state
 {
-	state st;
+	state_snapshot snapshot;
 	action_state action_st;
 	std::array<apm_t, 12> apm;
 };
@@ -94,13 +94,25 @@ struct main_t
 		ui.reset();
 	}
 
+	// Snapshots share unchanged object container chunks with the closest
+	// earlier snapshot. Each one still holds a full copy of
+	// state_base_copyable (about 47KB plus 6 bytes per map tile) and of the
+	// unit finder, paths and thingies.
+	const state_snapshot *previous_snapshot()
+	{
+		auto i = saved_states.lower_bound(ui.st.current_frame);
+		if (i == saved_states.begin())
+			return nullptr;
+		return &std::prev(i)->second->snapshot;
+	}
+
 	void save_initial_state() {
 		auto i = saved_states.find(ui.st.current_frame);
 		if (i == saved_states.end())
 		{
 			auto v = std::make_unique<saved_state>();
-			v->st = copy_state(ui.st);
-			v->action_st = copy_state(ui.action_st, ui.st, v->st);
+			v->snapshot.save(ui.st, previous_snapshot());
+			v->action_st = copy_state(ui.action_st, ui.st, ui.st);
 			v->apm = ui.apm;
 
 			a_map<int, std::unique_ptr<saved_state>> new_saved_states;
@@ -117,15 +129,15 @@ struct main_t
 	}
 
 	void next_replay_frame() {
-		int save_interval = 10 * 1000 / 42;
+		int save_interval = 1000 / 42;
 		if (ui.st.current_frame == 0 || ui.st.current_frame % save_interval == 0)
 		{
 			auto i = saved_states.find(ui.st.current_frame);
 			if (i == saved_states.end())
 			{
 				auto v = std::make_unique<saved_state>();
-				v->st = copy_state(ui.st);
-				v->action_st = copy_state(ui.action_st, ui.st, v->st);
+				v->snapshot.save(ui.st, previous_snapshot());
+				v->action_st = copy_state(ui.action_st, ui.st, ui.st);
 				v->apm = ui.apm;
 
 				a_map<int, std::unique_ptr<saved_state>> new_saved_states;
@@ -174,11 +186,12 @@ struct main_t
 					if (i != saved_states.begin())
 						--i;
 					auto &v = i->second;
-					if (ui.st.current_frame > ui.replay_frame || v->st.current_frame > ui.st.current_frame)
+					if (ui.st.current_frame > ui.replay_frame || v->snapshot.current_frame > ui.st.current_frame)
 					{
-						ui.st = copy_state(v->st);
-						ui.action_st = copy_state(v->action_st, v->st, ui.st);
+						v->snapshot.restore(ui.st);
+						ui.action_st = copy_state(v->action_st, ui.st, ui.st);
 						ui.apm = v->apm;
+						ui.mark_all_tiles_dirty();
 					}
 				}
 				if (ui.st.current_frame < ui.replay_frame)
@@ -297,13 +310,6 @@ struct main_t
 
 main_t *g_m = nullptr;
 
-uint32_t freemem_rand_state = (uint32_t)std::chrono::high_resolution_clock::now().time_since_epoch().count();
-auto freemem_rand()
-{
-	freemem_rand_state = freemem_rand_state * 22695477 + 1;
-	return (freemem_rand_state >> 16) & 0x7fff;
-}
-
 void out_of_memory()
 {
 	printf("out of memory :(\n");
@@ -324,32 +330,20 @@ void free_memory()
 	printf("n_states is %zu\n", n_states);
 	if (n_states <= 2)
 		out_of_memory();
-	size_t n;
-	if (n_states >= 300)
-		n = 1 + freemem_rand() % (n_states - 2);
-	else
+	// Evict the state whose neighbours are closest together, so the states
+	// that remain stay evenly spread over the replay. This is linear in the
+	// number of states, so it holds up with a state saved every 23 frames.
+	size_t n = 1;
+	int best_gap = std::numeric_limits<int>::max();
+	size_t i_n = 1;
+	auto prev = g_m->saved_states.begin();
+	for (auto i = std::next(prev); std::next(i) != g_m->saved_states.end(); prev = i++, ++i_n)
 	{
-		auto begin = std::next(g_m->saved_states.begin());
-		auto end = std::prev(g_m->saved_states.end());
-		n = 1;
-		int best_score = std::numeric_limits<int>::max();
-		size_t i_n = 1;
-		for (auto i = begin; i != end; ++i, ++i_n)
+		int gap = std::next(i)->first - prev->first;
+		if (gap < best_gap)
 		{
-			int score = 0;
-			for (auto i2 = begin; i2 != end; ++i2)
-			{
-				if (i2 != i)
-				{
-					int d = i2->first - i->first;
-					score += d * d;
-				}
-			}
-			if (score < best_score)
-			{
-				best_score = score;
-				n = i_n;
-			}
+			best_gap = gap;
+			n = i_n;
 		}
 	}
 	g_m->saved_states.erase(std::next(g_m->saved_states.begin(), n));
@@ -912,6 +906,9 @@ extern "C" void *get_buffer(int index)
 		return reinterpret_cast<void *>(m->ui.creep_edges.data());
 	case 16: 
 		return reinterpret_cast<void *>(m->ui.fow.data());
+	case 17: // changes since the last call, see generate_frame_delta
+		m->ui.generate_frame_delta();
+		return reinterpret_cast<void *>(m->ui.frame_delta.data());
 	default:
 		return nullptr;
 	}
@@ -956,6 +953,8 @@ extern "C" int counts(int index)
 		return m->ui.deleted_bullets.size();
 	case 19:
 		return m->ui.killed_units.size();
+	case 20: // words in the last frame delta
+		return m->ui.frame_delta.size();
 	default:
 		return 0;
 	}
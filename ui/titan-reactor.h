@@ -57,6 +57,70 @@ namespace bwgame
 		std::vector<research_in_production_t> research_in_production;
 	};
 
+	// Last exported record of every object of one kind, by index, so that
+	// generate_frame_delta only emits the objects that were created, changed or
+	// removed since the previous delta.
+	template <size_t record_size>
+	struct delta_shadow_t
+	{
+		using record = std::array<int32_t, record_size>;
+		std::vector<record> records;
+		std::vector<uint32_t> seen;
+		// seen[i] is the epoch of the last delta that exported object i; 0 is
+		// never a valid epoch.
+		uint32_t epoch = 1;
+
+		void clear()
+		{
+			records.clear();
+			seen.clear();
+			epoch = 1;
+		}
+
+		void begin()
+		{
+			++epoch;
+		}
+
+		// Whether the object at index was exported by the previous delta.
+		bool was_exported(size_t index) const
+		{
+			return index < seen.size() && seen[index] == epoch - 1;
+		}
+
+		// Remembers r and returns whether it differs from the last exported record.
+		bool update(size_t index, const record &r)
+		{
+			if (index >= records.size())
+			{
+				records.resize(index + 1);
+				seen.resize(index + 1);
+			}
+			bool was_seen = seen[index] == epoch - 1;
+			seen[index] = epoch;
+			if (was_seen && records[index] == r)
+				return false;
+			records[index] = r;
+			return true;
+		}
+
+		// Calls f with the index of every object that was exported last time
+		// but not updated this time.
+		template <typename F>
+		void for_each_removed(F &&f) const
+		{
+			for (size_t i = 0; i != seen.size(); ++i)
+			{
+				if (seen[i] == epoch - 1)
+					f(i);
+			}
+		}
+	};
+
+	static const size_t unit_delta_size = 12;
+	static const size_t sprite_delta_size = 8;
+	static const size_t image_delta_size = 8;
+
 	struct titan_replay_functions : ui_functions
 	{
 		game_player player;
@@ -73,6 +137,31 @@ namespace bwgame
 		std::vector<uint8_t> creep_edges;
 		uint8_t player_visibility;
 
+		// Tiles whose fow/creep values may be out of date, filled in by the tile
+		// hooks below. A tile is only ever queued once; fow_fading_tiles are the
+		// tiles that have not finished fading towards their current value yet.
+		std::vector<size_t> fow_dirty_tiles;
+		std::vector<size_t> fow_fading_tiles;
+		std::vector<uint8_t> fow_tile_queued;
+		bool fow_all_dirty = true;
+		uint8_t fow_player_visibility = 0;
+		std::vector<size_t> creep_dirty_tiles;
+		std::vector<uint8_t> creep_tile_queued;
+		bool creep_all_dirty = true;
+
+		// State for generate_frame_delta: the tiles that may have changed since
+		// the last delta, and the last exported value of every tile and object.
+		std::vector<size_t> delta_dirty_tiles;
+		std::vector<uint8_t> delta_tile_queued;
+		bool delta_all_tiles_dirty = true;
+		std::vector<uint32_t> delta_tiles;
+		delta_shadow_t<unit_delta_size> delta_units;
+		delta_shadow_t<sprite_delta_size> delta_sprites;
+		delta_shadow_t<image_delta_size> delta_images;
+		std::vector<int32_t> frame_delta;
+		std::vector<int32_t> frame_delta_images;
+		std::vector<int32_t> frame_delta_replaced_units;
+
 		titan_replay_functions(game_player player) : ui_functions(std::move(player))
 		{
 		}
@@ -82,6 +171,70 @@ namespace bwgame
 			creep.resize(game_st.map_width * game_st.map_height);
 			creep_edges.resize(game_st.map_width * game_st.map_height);
 			fow.resize(game_st.map_width * game_st.map_height);
+			fow_tile_queued.assign(st.tiles.size(), 0);
+			creep_tile_queued.assign(st.tiles.size(), 0);
+			delta_tile_queued.assign(st.tiles.size(), 0);
+			delta_tiles.assign(st.tiles.size(), ~(uint32_t)0);
+			mark_all_tiles_dirty();
+		}
+
+		// For changes to the tiles that do not go through the hooks, like
+		// restoring a snapshot.
+		void mark_all_tiles_dirty()
+		{
+			fow_all_dirty = true;
+			creep_all_dirty = true;
+			delta_all_tiles_dirty = true;
+		}
+
+		static void queue_tile(std::vector<size_t> &tiles, std::vector<uint8_t> &queued, size_t index)
+		{
+			if (queued[index])
+				return;
+			queued[index] = 1;
+			tiles.push_back(index);
+		}
+
+		virtual void on_tiles_revealed(size_t base_index, const int *relative_index, size_t count) override
+		{
+			if (!fow_all_dirty)
+			{
+				for (size_t i = 0; i != count; ++i)
+					queue_tile(fow_dirty_tiles, fow_tile_queued, base_index + relative_index[i]);
+			}
+			if (!delta_all_tiles_dirty)
+			{
+				for (size_t i = 0; i != count; ++i)
+					queue_tile(delta_dirty_tiles, delta_tile_queued, base_index + relative_index[i]);
+			}
+		}
+
+		virtual void on_tiles_visibility_reset() override
+		{
+			fow_all_dirty = true;
+			delta_all_tiles_dirty = true;
+		}
+
+		virtual void on_tile_creep_changed(size_t index) override
+		{
+			if (!delta_all_tiles_dirty)
+				queue_tile(delta_dirty_tiles, delta_tile_queued, index);
+			if (creep_all_dirty)
+				return;
+			// The creep edge of a tile depends on its 8 neighbours.
+			size_t tile_x = index % game_st.map_tile_width;
+			size_t tile_y = index / game_st.map_tile_width;
+			for (int add_y = -1; add_y <= 1; ++add_y)
+			{
+				for (int add_x = -1; add_x <= 1; ++add_x)
+				{
+					if (tile_x + add_x >= game_st.map_tile_width)
+						continue;
+					if (tile_y + add_y >= game_st.map_tile_height)
+						continue;
+					queue_tile(creep_dirty_tiles, creep_tile_queued, tile_x + add_x + (tile_y + add_y) * game_st.map_tile_width);
+				}
+			}
 		}
 
 		virtual void play_sound(int id, xy position, const unit_t *source_unit, bool add_race_index) override
@@ -290,6 +443,21 @@ namespace bwgame
 			fow.clear();
 			creep.clear();
 			creep_edges.clear();
+			fow_dirty_tiles.clear();
+			fow_fading_tiles.clear();
+			fow_tile_queued.clear();
+			creep_dirty_tiles.clear();
+			creep_tile_queued.clear();
+			delta_dirty_tiles.clear();
+			delta_tile_queued.clear();
+			delta_tiles.clear();
+			delta_units.clear();
+			delta_sprites.clear();
+			delta_images.clear();
+			frame_delta.clear();
+			frame_delta_images.clear();
+			frame_delta_replaced_units.clear();
+			mark_all_tiles_dirty();
 
 			apm = {};
 			auto &game = *st.game;
@@ -318,97 +486,335 @@ namespace bwgame
 		}
 
 		//	extracted from drawing.h -> draw_tiles
+		void update_creep_tile(size_t tile_x, size_t tile_y)
+		{
+			static const xy dirs[9] = {{1, 1}, {0, 1}, {-1, 1}, {1, 0}, {-1, 0}, {1, -1}, {0, -1}, {-1, -1}, {0, 0}};
+
+			size_t tile_index = tile_y * game_st.map_tile_width + tile_x;
+			auto *tile = &st.tiles[tile_index];
+
+			creep[tile_index] = 0;
+			creep_edges[tile_index] = 0;
+
+			if (tile->flags & tile_t::flag_has_creep)
+			{
+				creep[tile_index] = game_st.cv5.at(1).mega_tile_index[creep_random_tile_indices[tile_index]];
+			}
+			else
+			{
+				size_t creep_index = 0;
+				for (size_t i = 0; i != 9; ++i)
+				{
+					int add_x = dirs[i].x;
+					int add_y = dirs[i].y;
+					if (tile_x + add_x >= game_st.map_tile_width)
+						continue;
+					if (tile_y + add_y >= game_st.map_tile_height)
+						continue;
+					if (st.tiles[tile_x + add_x + (tile_y + add_y) * game_st.map_tile_width].flags & tile_t::flag_has_creep)
+						creep_index |= 1 << i;
+				}
+				creep_edges[tile_index] = img.creep_edge_frame_index[creep_index];
+			}
+		}
+
 		void generate_creep()
 		{
 			if (st.creep_life.recede_timer > 0) {
 				return;
 			}
 
-			xy dirs[9] = {{1, 1}, {0, 1}, {-1, 1}, {1, 0}, {-1, 0}, {1, -1}, {0, -1}, {-1, -1}, {0, 0}};
-
-			for (int tile_y = 0; tile_y < game_st.map_height; ++tile_y)
+			if (creep_all_dirty)
 			{
-				for (int tile_x = 0; tile_x < game_st.map_width; ++tile_x)
+				creep_all_dirty = false;
+				for (size_t i : creep_dirty_tiles)
+					creep_tile_queued[i] = 0;
+				creep_dirty_tiles.clear();
+				for (size_t tile_y = 0; tile_y != game_st.map_tile_height; ++tile_y)
 				{
-					size_t tile_index = tile_y * game_st.map_tile_width + tile_x;
-					auto *megatile_index = &st.tiles_mega_tile_index[tile_index];
-					auto *tile = &st.tiles[tile_index];
-
-					creep[tile_index] = 0;
-					creep_edges[tile_index] = 0;
-
-					if (tile->flags & tile_t::flag_has_creep)
+					for (size_t tile_x = 0; tile_x != game_st.map_tile_width; ++tile_x)
 					{
-						creep[tile_index] = game_st.cv5.at(1).mega_tile_index[creep_random_tile_indices[tile_x + tile_y * game_st.map_tile_width]];
+						update_creep_tile(tile_x, tile_y);
 					}
+				}
+				return;
+			}
 
-					if (~tile->flags & tile_t::flag_has_creep)
-					{
-						size_t creep_index = 0;
-						for (size_t i = 0; i != 9; ++i)
-						{
-							int add_x = dirs[i].x;
-							int add_y = dirs[i].y;
-							if (tile_x + add_x >= game_st.map_tile_width)
-								continue;
-							if (tile_y + add_y >= game_st.map_tile_height)
-								continue;
-							if (st.tiles[tile_x + add_x + (tile_y + add_y) * game_st.map_tile_width].flags & tile_t::flag_has_creep)
-								creep_index |= 1 << i;
-						}
-						size_t creep_frame = img.creep_edge_frame_index[creep_index];
+			for (size_t i : creep_dirty_tiles)
+			{
+				creep_tile_queued[i] = 0;
+				update_creep_tile(i % game_st.map_tile_width, i / game_st.map_tile_width);
+			}
+			creep_dirty_tiles.clear();
+		}
 
-						if (creep_frame)
-						{
+		// Returns whether the tile is still fading.
+		bool update_fow_tile(size_t i, bool instant)
+		{
+			auto &tile = st.tiles[i];
+			int v = 15;
 
-							creep_edges[tile_index] = creep_frame;
-						}
-					}
+			if (~tile.explored & player_visibility)
+			{
+				v = 55;
+			}
+			if (~tile.visible & player_visibility)
+			{
+				v = 255;
+			}
+
+			if (instant)
+			{
+				fow[i] = v;
+			}
+			else
+			{
+				if (v > fow[i])
+				{
+					fow[i] = std::min(v, fow[i] + 10);
+				}
+				else if (v < fow[i])
+				{
+					fow[i] = std::max(v, fow[i] - 5);
 				}
 			}
+			return fow[i] != v;
 		}
 
 		void generate_fow(bool instant)
 		{
-			int i = 0;
-			for (auto &tile : st.tiles)
+			if (player_visibility != fow_player_visibility)
 			{
-				int v = 15;
+				fow_player_visibility = player_visibility;
+				fow_all_dirty = true;
+			}
 
-				if (~tile.explored & player_visibility)
+			if (fow_all_dirty)
+			{
+				fow_all_dirty = false;
+				for (size_t i : fow_dirty_tiles)
+					fow_tile_queued[i] = 0;
+				fow_dirty_tiles.clear();
+				fow_fading_tiles.clear();
+				for (size_t i = 0; i != st.tiles.size(); ++i)
 				{
-					v = 55;
+					if (update_fow_tile(i, instant))
+						fow_fading_tiles.push_back(i);
 				}
-				if (~tile.visible & player_visibility)
+				return;
+			}
+
+			for (size_t i : fow_fading_tiles)
+			{
+				if (fow_tile_queued[i])
+					continue;
+				fow_tile_queued[i] = 1;
+				fow_dirty_tiles.push_back(i);
+			}
+			fow_fading_tiles.clear();
+			for (size_t i : fow_dirty_tiles)
+			{
+				fow_tile_queued[i] = 0;
+				if (update_fow_tile(i, instant))
+					fow_fading_tiles.push_back(i);
+			}
+			fow_dirty_tiles.clear();
+		}
+
+		// Only the tiles that changed since the last call (and the ones still
+		// fading) are updated.
+		void generate_frame() 
+		{
+			generate_creep();
+			generate_fow(false);
+		}
+
+		// Everything the frontend needs to know that changed since the previous
+		// call, as one stream of 32-bit words:
+		//
+		//	version, frame
+		//	tile rect count, then per rect: x, y, width, height and width * height
+		//	  tile values (visible | explored << 8 | flags << 16), row by row
+		//	unit count, then unit_delta_size words per unit:
+		//	  id, type, owner, x, y, hp, shields, energy, order, status flags,
+		//	  sprite index, remaining build time
+		//	removed unit count, then their ids; this includes units whose index
+		//	  was taken by a new unit since the previous delta
+		//	sprite count, then sprite_delta_size words per sprite:
+		//	  index, type, owner, x, y, flags, elevation, main image index
+		//	removed sprite count, then their indices
+		//	image count, then image_delta_size words per image:
+		//	  index, type, sprite index, frame index, flags, modifier, offset x, offset y
+		//	removed image count, then their indices
+		//
+		// hp, shields and energy are raw fp8 values and missing indices are -1.
+		// After a load, reset or snapshot restore the next delta contains every
+		// tile and object that differs from what was last exported.
+		void generate_frame_delta()
+		{
+			static const int32_t version = 1;
+			auto &out = frame_delta;
+			out.clear();
+			out.push_back(version);
+			out.push_back(st.current_frame);
+
+			auto begin_count = [&]() {
+				out.push_back(0);
+				return out.size() - 1;
+			};
+
+			// Tiles, as runs of changed tiles within a row.
+			size_t tile_rects = begin_count();
+			auto tile_value = [&](size_t index) {
+				auto &t = st.tiles[index];
+				return (uint32_t)t.visible | (uint32_t)t.explored << 8 | (uint32_t)t.flags << 16;
+			};
+			if (delta_all_tiles_dirty)
+			{
+				delta_all_tiles_dirty = false;
+				for (size_t i : delta_dirty_tiles)
+					delta_tile_queued[i] = 0;
+				delta_dirty_tiles.clear();
+				for (size_t i = 0; i != st.tiles.size(); ++i)
 				{
-					v = 255;
+					if (tile_value(i) != delta_tiles[i])
+						delta_dirty_tiles.push_back(i);
 				}
-
-				if (instant)
+			}
+			else
+			{
+				std::sort(delta_dirty_tiles.begin(), delta_dirty_tiles.end());
+			}
+			size_t run_begin = 0;
+			size_t run_size = 0;
+			size_t run_header = 0;
+			for (size_t i : delta_dirty_tiles)
+			{
+				delta_tile_queued[i] = 0;
+				uint32_t v = tile_value(i);
+				if (v == delta_tiles[i])
+					continue;
+				delta_tiles[i] = v;
+				if (run_size && i == run_begin + run_size && i % game_st.map_tile_width != 0)
 				{
-					fow[i] = v;
+					++run_size;
+					++out[run_header + 2];
 				}
 				else
 				{
-					if (v > fow[i])
+					run_begin = i;
+					run_size = 1;
+					run_header = out.size();
+					out.push_back((int32_t)(i % game_st.map_tile_width));
+					out.push_back((int32_t)(i / game_st.map_tile_width));
+					out.push_back(1);
+					out.push_back(1);
+					++out[tile_rects];
+				}
+				out.push_back((int32_t)v);
+			}
+			delta_dirty_tiles.clear();
+
+			size_t units = begin_count();
+			std::vector<int32_t> &replaced_units = frame_delta_replaced_units;
+			replaced_units.clear();
+			delta_units.begin();
+			for (auto &list : st.player_units)
+			{
+				for (const unit_t *u : ptr(list))
+				{
+					delta_shadow_t<unit_delta_size>::record r = {
+						(int32_t)get_unit_id(u).raw_value,
+						(int32_t)u->unit_type->id,
+						u->owner,
+						u->sprite ? u->sprite->position.x : u->position.x,
+						u->sprite ? u->sprite->position.y : u->position.y,
+						(int32_t)u->hp.raw_value,
+						(int32_t)u->shield_points.raw_value,
+						(int32_t)u->energy.raw_value,
+						u->order_type ? (int32_t)u->order_type->id : -1,
+						u->status_flags,
+						u->sprite ? (int32_t)u->sprite->index : -1,
+						u->remaining_build_time,
+					};
+					// A new unit can take the index of one that died since the
+					// last delta; the old unit id must still be reported as removed.
+					if (delta_units.was_exported(u->index) && delta_units.records[u->index][0] != r[0])
+						replaced_units.push_back(delta_units.records[u->index][0]);
+					if (!delta_units.update(u->index, r))
+						continue;
+					out.insert(out.end(), r.begin(), r.end());
+					++out[units];
+				}
+			}
+			size_t removed_units = begin_count();
+			for (int32_t id : replaced_units)
+			{
+				out.push_back(id);
+				++out[removed_units];
+			}
+			delta_units.for_each_removed([&](size_t i) {
+				out.push_back(delta_units.records[i][0]);
+				++out[removed_units];
+			});
+
+			size_t sprites = begin_count();
+			size_t images = 0;
+			std::vector<int32_t> &image_records = frame_delta_images;
+			image_records.clear();
+			delta_sprites.begin();
+			delta_images.begin();
+			for (auto &line : st.sprites_on_tile_line)
+			{
+				for (const sprite_t *sprite : ptr(line))
+				{
+					delta_shadow_t<sprite_delta_size>::record r = {
+						(int32_t)sprite->index,
+						(int32_t)sprite->sprite_type->id,
+						sprite->owner,
+						sprite->position.x,
+						sprite->position.y,
+						sprite->flags,
+						sprite->elevation_level,
+						sprite->main_image ? (int32_t)sprite->main_image->index : -1,
+					};
+					if (delta_sprites.update(sprite->index, r))
 					{
-						fow[i] = std::min(v, fow[i] + 10);
+						out.insert(out.end(), r.begin(), r.end());
+						++out[sprites];
 					}
-					else if (v < fow[i])
+					for (const image_t *image : ptr(sprite->images))
 					{
-						fow[i] = std::max(v, fow[i] - 5);
+						delta_shadow_t<image_delta_size>::record ir = {
+							(int32_t)image->index,
+							(int32_t)image->image_type->id,
+							(int32_t)sprite->index,
+							(int32_t)image->frame_index,
+							image->flags,
+							image->modifier,
+							image->offset.x,
+							image->offset.y,
+						};
+						if (!delta_images.update(image->index, ir))
+							continue;
+						image_records.insert(image_records.end(), ir.begin(), ir.end());
+						++images;
 					}
 				}
-
-				i++;
 			}
-		};
-
-		//TODO: optimize when this is called as this is slow
-		void generate_frame() 
-		{
-			// generate_creep();
-			generate_fow(false);
+			size_t removed_sprites = begin_count();
+			delta_sprites.for_each_removed([&](size_t i) {
+				out.push_back((int32_t)i);
+				++out[removed_sprites];
+			});
+
+			out.push_back((int32_t)images);
+			out.insert(out.end(), image_records.begin(), image_records.end());
+			size_t removed_images = begin_count();
+			delta_images.for_each_removed([&](size_t i) {
+				out.push_back((int32_t)i);
+				++out[removed_images];
+			});
 		}
 	};
 